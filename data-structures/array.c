@@ -1,101 +1,109 @@
-#include <assert.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
+#define _GNU_SOURCE  // mremap()
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "array.h"
 
-// typedef int T;
+#ifdef DS_STATS
+struct array_stats_t _array_stats;
 
-#define USE_ARRAY(T)                                                            \
-                                                                                \
-struct T##_array_t {                                                            \
-    T * addr;                                                                   \
-    unsigned length;                                                            \
-    unsigned capacity;                                                          \
-};                                                                              \
-                                                                                \
-static struct T##_array_t create_array_##T(int length, int capacity) {          \
-    assert(capacity > 0);                                                       \
-    struct T##_array_t arr;                                                     \
-    arr.addr = calloc(capacity, sizeof(T));                                     \
-    if (arr.addr == NULL) {                                                     \
-        arr.length = arr.capacity = 0;                                          \
-    } else {                                                                    \
-        arr.length = length;                                                    \
-        arr.capacity = capacity;                                                \
-    }                                                                           \
-    return arr;                                                                 \
-}                                                                               \
-                                                                                \
-static void delete_array_##T(struct T##_array_t * arr) {                        \
-    assert(arr != NULL);                                                        \
-    if (arr->addr != NULL) {                                                    \
-        free(arr->addr);                                                        \
-    }                                                                           \
-    arr->length = arr->capacity = 0;                                            \
-}                                                                               \
-                                                                                \
-/* amortized time complexity: O(1) */                                           \
-static void append_##T(struct T##_array_t * arr, T val) {                       \
-    assert(arr != NULL);                                                        \
-    if (arr->length >= arr->capacity) {                                         \
-        T * new_addr = realloc(arr->addr, sizeof(T) * (arr->capacity * 2));     \
-        assert(new_addr != NULL);                                               \
-        arr->addr = new_addr;                                                   \
-        arr->capacity = arr->capacity * 2;                                      \
-    }                                                                           \
-    arr->addr[arr->length++] = val;                                             \
-}                                                                               \
-                                                                                \
-static T pop_##T(struct T##_array_t * arr) {                                    \
-    assert(arr != NULL && arr->length > 0);                                     \
-    T ans = arr->addr[--(arr->length)];                                         \
-    if (arr->length < arr->capacity / 2) {                                      \
-        arr->capacity /= 2;                                                     \
-        arr->addr = realloc(arr->addr, sizeof(T) * arr->capacity);              \
-        assert(arr->addr != NULL);                                              \
-    }                                                                           \
-    return ans;                                                                 \
-}                                                                               \
-                                                                                \
-typedef struct T##_array_t T##_array_t
-
-#define array_t(T) T##_array_t
-#define create_array(T, length, capacity) create_array_##T((length), (capacity))
-#define delete_array(T, arr) delete_array_##T((arr))
-#define append(T, arr, val) append_##T((arr), (val))
-#define pop(T, arr) pop_##T((arr))
-#define at(arr, index) ((arr).addr[index])
+/** Counters of all arrays, whatever their element type, see stats.h */
+struct array_stats_t array_stats(void) {
+    return _array_stats_read(&_array_stats);
+}
+#endif
 
-USE_ARRAY(int);
+/**
+ * Grows the file and its mapping to bytes; returns the new base, which may have moved
+ * Returns NULL if the file or the mapping could not grow, and base then stays mapped as it was.
+ */
+void * _array_file_resize(int fd, void * base, size_t old_bytes, size_t bytes) {
+    if (ftruncate(fd, bytes) != 0) return NULL;
+#ifdef MREMAP_MAYMOVE
+    void * moved = mremap(base, old_bytes, bytes, MREMAP_MAYMOVE);
+#else
+    void * moved = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (moved != MAP_FAILED) munmap(base, old_bytes);
+#endif
+    return moved == MAP_FAILED ? NULL : moved;
+}
 
-int main() {
-    array_t(int) arr = create_array(int, 3, 3);
-    for (int i = 0; i < arr.length; ++i) {
-        at(arr, i) = i * 10;
-        printf("set arr[%d] = %d\n", i, at(arr, i));
+/**
+ * Maps path, creating it if needed, and returns the element area, or NULL
+ * *length and *capacity receive what the file holds. O(1): elements are neither read nor copied.
+ */
+void * _array_file_open(const char * path, size_t elem_size, int * fd, size_t * length, size_t * capacity) {
+    *fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (*fd < 0) return NULL;
+    struct stat st;
+    if (fstat(*fd, &st) != 0) {
+        close(*fd);
+        *fd = -1;
+        return NULL;
     }
-    append(int, &arr, 30);
-    append(int, &arr, 40);
-    append(int, &arr, 50);
-    printf("arr.length = %u, arr.capacity = %u\n", arr.length, arr.capacity);
-    while (arr.length > 0) {
-        printf("pop %d\n", pop(int, &arr));
+    struct array_file_header_t * header = MAP_FAILED;
+    bool created = st.st_size == 0;
+    if (created && ftruncate(*fd, ARRAY_FILE_MIN_BYTES) == 0) st.st_size = ARRAY_FILE_MIN_BYTES;
+    if ((size_t)st.st_size >= sizeof(struct array_file_header_t)) {
+        header = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
     }
-    printf("arr.length = %u, arr.capacity = %u\n", arr.length, arr.capacity);
-    for (int i = 0; i < 10; ++i) {
-        append(int, &arr, -i);
-        for (int i = 0; i < arr.capacity; ++i) {
-            printf(" %d", at(arr, i));
-        }
-        printf(" | length=%d\n", arr.length);
+    if (header != MAP_FAILED && created) {
+        header->magic = ARRAY_FILE_MAGIC;
+        header->version = ARRAY_FILE_VERSION;
+        header->elem_size = elem_size;
+        header->length = 0;
     }
-    for (int i = 0; i < arr.length; ++i) {
-        printf("arr[%d] = %d\n", i, at(arr, i));
+    if (header == MAP_FAILED || header->magic != ARRAY_FILE_MAGIC || header->version != ARRAY_FILE_VERSION
+        || header->elem_size != elem_size
+        || header->length > (st.st_size - sizeof(struct array_file_header_t)) / elem_size) {
+        if (header != MAP_FAILED) munmap(header, st.st_size);
+        close(*fd);
+        *fd = -1;
+        return NULL;
     }
-    while (arr.length > 5) {
-        printf("pop %d\n", pop(int, &arr));
+    *length = header->length;
+    *capacity = (st.st_size - sizeof(struct array_file_header_t)) / elem_size;
+    return header + 1;
+}
+
+/** Writes length into the header and flushes the mapping to the file */
+bool _array_file_sync(void * addr, size_t elem_size, size_t length, size_t capacity) {
+    struct array_file_header_t * header = (struct array_file_header_t *)addr - 1;
+    header->length = length;
+    return msync(header, sizeof(struct array_file_header_t) + elem_size * capacity, MS_SYNC) == 0;
+}
+
+void _array_file_close(int fd, void * addr, size_t bytes) {
+    munmap((struct array_file_header_t *)addr - 1, bytes);
+    close(fd);
+}
+
+struct _array_chunk_t {
+    struct task_t task;
+    void (*run)(void * ctx, unsigned i);
+    void * ctx;
+    unsigned i;
+};
+
+static void _array_run_chunk(void * arg) {
+    struct _array_chunk_t * chunk = arg;
+    chunk->run(chunk->ctx, chunk->i);
+}
+
+/** Calls run(ctx, i) for every i < count, spread over the pool, and waits for all of them */
+void _array_parallel_for(struct thread_pool_t * threads, unsigned count, void (*run)(void * ctx, unsigned i),
+                         void * ctx) {
+    assert(count <= ARRAY_MAX_CHUNKS);
+    struct _array_chunk_t chunks[ARRAY_MAX_CHUNKS];
+    for (unsigned i = 1; i < count; ++i) {
+        chunks[i].run = run;
+        chunks[i].ctx = ctx;
+        chunks[i].i = i;
+        chunks[i].task.run = _array_run_chunk;
+        chunks[i].task.arg = chunks + i;
+        thread_pool_fork(threads, &chunks[i].task);
     }
-    printf("arr.length = %u, arr.capacity = %u\n", arr.length, arr.capacity);
-    delete_array(int, &arr);
-    return 0;
+    if (count > 0) run(ctx, 0);
+    for (unsigned i = 1; i < count; ++i) thread_pool_join(threads, &chunks[i].task);
 }
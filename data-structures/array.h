@@ -0,0 +1,585 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+#include "thread_pool.h"
+
+#define ARRAY_SMALL_BYTES 32  // inline storage of a USE_ARRAY(T) array
+
+/**
+ * First bytes of a file that backs an array; the elements follow it
+ * length is only brought up to date by sync_array() and delete_array().
+ */
+struct array_file_header_t {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t elem_size;
+    uint64_t length;
+    char padding[40];  // keeps the elements cache-line aligned
+};
+
+#define ARRAY_FILE_MAGIC 0x50414d5941525241ULL  // "ARRAYMAP" read as little-endian
+#define ARRAY_FILE_VERSION 1
+#define ARRAY_FILE_MIN_BYTES 4096
+
+// Used by the generated functions, defined in array.c
+void * _array_file_resize(int fd, void * base, size_t old_bytes, size_t bytes);
+void * _array_file_open(const char * path, size_t elem_size, int * fd, size_t * length, size_t * capacity);
+bool _array_file_sync(void * addr, size_t elem_size, size_t length, size_t capacity);
+void _array_file_close(int fd, void * addr, size_t bytes);
+
+#define _ARRAY_FILE_BYTES(T, capacity) (sizeof(struct array_file_header_t) + sizeof(T) * (capacity))
+
+/*
+ * USE_ARRAY_N(T, N) keeps up to N elements inside the array struct itself, so small arrays
+ * never touch the heap; addr stays NULL until they outgrow it.
+ * USE_ARRAY(T) picks N so that the inline storage takes about ARRAY_SMALL_BYTES.
+ * open_array() gives an array whose addr maps a file instead: it grows the file, never
+ * shrinks, and reopening the file gives back the elements as of the last sync_array().
+ */
+#ifdef DS_STATS
+extern struct array_stats_t _array_stats;  // of all arrays, defined in array.c
+struct array_stats_t array_stats(void);
+#endif
+
+#define USE_ARRAY(T) USE_ARRAY_N(T, sizeof(T) < ARRAY_SMALL_BYTES ? ARRAY_SMALL_BYTES / sizeof(T) : 1)
+
+#define USE_ARRAY_N(T, N)                                                       \
+                                                                                \
+struct T##_array_t {                                                            \
+    T * addr;  /* heap storage, NULL while the elements fit in small */         \
+    size_t length;                                                              \
+    size_t capacity;                                                            \
+    int fd;  /* the file addr maps, or -1 */                                    \
+    T small[N];                                                                 \
+};                                                                              \
+                                                                                \
+inline static struct T##_array_t create_array_##T(size_t length, size_t capacity) { \
+    assert(length <= capacity);                                                 \
+    struct T##_array_t arr;                                                     \
+    arr.addr = NULL;                                                            \
+    arr.length = 0;                                                             \
+    arr.capacity = (N);                                                         \
+    arr.fd = -1;                                                                \
+    if (capacity <= (N)) {                                                      \
+        memset(arr.small, 0, sizeof(arr.small));                                \
+        arr.length = length;                                                    \
+        return arr;                                                             \
+    }                                                                           \
+    arr.addr = calloc(capacity, sizeof(T));                                     \
+    _STATS_ADD(_array_stats.bytes_allocated, sizeof(T) * capacity);             \
+    if (arr.addr != NULL) {                                                     \
+        arr.length = length;                                                    \
+        arr.capacity = capacity;                                                \
+    }                                                                           \
+    return arr;                                                                 \
+}                                                                               \
+                                                                                \
+/* Maps path (see _array_file_open()); on failure, arr.fd is -1 and the array is empty */ \
+inline static struct T##_array_t open_array_##T(const char * path) {           \
+    assert(path != NULL);                                                       \
+    struct T##_array_t arr = create_array_##T(0, 0);                            \
+    size_t length, capacity;                                                    \
+    T * addr = _array_file_open(path, sizeof(T), &arr.fd, &length, &capacity);  \
+    if (addr != NULL) {                                                         \
+        arr.addr = addr;                                                        \
+        arr.length = length;                                                    \
+        arr.capacity = capacity;                                                \
+    }                                                                           \
+    return arr;                                                                 \
+}                                                                               \
+                                                                                \
+/* Makes the elements of a file-backed array durable; no-op for other arrays */ \
+inline static bool sync_array_##T(struct T##_array_t * arr) {                   \
+    assert(arr != NULL);                                                        \
+    if (arr->fd < 0) return true;                                               \
+    return _array_file_sync(arr->addr, sizeof(T), arr->length, arr->capacity);  \
+}                                                                               \
+                                                                                \
+/* The array is left empty, and still usable; a file-backed one is synced and closed */ \
+inline static void delete_array_##T(struct T##_array_t * arr) {                 \
+    assert(arr != NULL);                                                        \
+    if (arr->fd >= 0) {                                                         \
+        sync_array_##T(arr);                                                    \
+        _array_file_close(arr->fd, arr->addr, _ARRAY_FILE_BYTES(T, arr->capacity)); \
+        arr->fd = -1;                                                           \
+    } else if (arr->addr != NULL) {                                             \
+        free(arr->addr);                                                        \
+    }                                                                           \
+    arr->addr = NULL;                                                           \
+    arr->length = 0;                                                            \
+    arr->capacity = (N);                                                        \
+}                                                                               \
+                                                                                \
+/*                                                                              \
+ * Moves the elements to a heap block of exactly capacity elements, or grows the file \
+ * Returns false if the heap or the file could not provide it; arr is then unchanged. \
+ */                                                                             \
+inline static bool _array_realloc_##T(struct T##_array_t * arr, size_t capacity) { \
+    assert(capacity > (N) && capacity >= arr->length);                          \
+    _STATS_ADD(_array_stats.reallocs, 1);                                       \
+    _STATS_ADD(_array_stats.bytes_allocated, sizeof(T) * capacity);             \
+    if (arr->fd >= 0) {                                                         \
+        struct array_file_header_t * header = _array_file_resize(arr->fd,      \
+            (struct array_file_header_t *)arr->addr - 1, _ARRAY_FILE_BYTES(T, arr->capacity), \
+            _ARRAY_FILE_BYTES(T, capacity));                                    \
+        if (header == NULL) return false;                                       \
+        arr->addr = (T *)(header + 1);                                          \
+        arr->capacity = capacity;                                               \
+        return true;                                                            \
+    }                                                                           \
+    T * new_addr = realloc(arr->addr, sizeof(T) * capacity);                    \
+    if (new_addr == NULL) return false;                                         \
+    if (arr->addr == NULL) memcpy(new_addr, arr->small, sizeof(T) * arr->length); \
+    arr->addr = new_addr;                                                       \
+    arr->capacity = capacity;                                                   \
+    return true;                                                                \
+}                                                                               \
+                                                                                \
+/* Largest capacity whose size in bytes (with the file header, if any) fits in a size_t */ \
+inline static size_t _array_max_capacity_##T(const struct T##_array_t * arr) {  \
+    return arr->fd >= 0 ? (SIZE_MAX - sizeof(struct array_file_header_t)) / sizeof(T) : SIZE_MAX / sizeof(T); \
+}                                                                               \
+                                                                                \
+/* Makes room for capacity elements in total; never shrinks. False if it could not */ \
+inline static bool reserve_##T(struct T##_array_t * arr, size_t capacity) {     \
+    assert(arr != NULL);                                                        \
+    if (capacity <= arr->capacity) return true;                                 \
+    if (capacity > _array_max_capacity_##T(arr)) return false;                  \
+    return _array_realloc_##T(arr, capacity);                                   \
+}                                                                               \
+                                                                                \
+/* Makes room for extra more elements, at least doubling the capacity */        \
+inline static bool _array_grow_##T(struct T##_array_t * arr, size_t extra) {    \
+    size_t max = _array_max_capacity_##T(arr);                                  \
+    if (arr->length > max || extra > max - arr->length) return false;           \
+    size_t needed = arr->length + extra;                                        \
+    if (needed <= arr->capacity) return true;                                   \
+    size_t capacity = arr->capacity <= max / 2 ? arr->capacity * 2 : max;       \
+    return reserve_##T(arr, capacity > needed ? capacity : needed);             \
+}                                                                               \
+                                                                                \
+/*                                                                              \
+ * Halves the capacity while length is at most a quarter of it, so that an array \
+ * bouncing around a power of two doesn't realloc on every append/pop            \
+ */                                                                             \
+inline static void _array_shrink_##T(struct T##_array_t * arr) {                \
+    if (arr->addr == NULL || arr->fd >= 0 || arr->length > arr->capacity / 4) return; \
+    size_t capacity = arr->capacity;                                            \
+    while (arr->length <= capacity / 4 && capacity / 2 > (N)) capacity /= 2;    \
+    if (arr->length <= capacity / 4) { /* back into the inline storage */      \
+        memcpy(arr->small, arr->addr, sizeof(T) * arr->length);                 \
+        free(arr->addr);                                                        \
+        arr->addr = NULL;                                                       \
+        arr->capacity = (N);                                                    \
+    } else {                                                                    \
+        _array_realloc_##T(arr, capacity);  /* on failure the larger block stays */ \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+/*                                                                              \
+ * The calls that add elements return false, leaving arr unchanged, when it has to grow \
+ * and the heap or (for a file-backed array) the file cannot.                   \
+ */                                                                             \
+                                                                                \
+/* amortized time complexity: O(1) */                                           \
+inline static bool append_##T(struct T##_array_t * arr, T val) {                \
+    assert(arr != NULL);                                                        \
+    _STATS_ADD(_array_stats.appends, 1);                                        \
+    if (arr->length >= arr->capacity && !_array_grow_##T(arr, 1)) return false; \
+    array_data(*arr)[arr->length++] = val;                                      \
+    return true;                                                                \
+}                                                                               \
+                                                                                \
+/* vals must not point into arr; see extend_##T() */                            \
+inline static bool append_n_##T(struct T##_array_t * arr, const T * vals, size_t n) { \
+    assert(arr != NULL && (n == 0 || vals != NULL));                            \
+    if (!_array_grow_##T(arr, n)) return false;                                 \
+    if (n > 0) memcpy(array_data(*arr) + arr->length, vals, sizeof(T) * n);     \
+    arr->length += n;                                                           \
+    return true;                                                                \
+}                                                                               \
+                                                                                \
+/* Appends all elements of other, which may be arr itself */                    \
+inline static bool extend_##T(struct T##_array_t * arr, struct T##_array_t * other) { \
+    assert(arr != NULL && other != NULL);                                       \
+    size_t n = other->length;                                                   \
+    if (!_array_grow_##T(arr, n)) return false;                                 \
+    if (n > 0) memcpy(array_data(*arr) + arr->length, array_data(*other), sizeof(T) * n); \
+    arr->length += n;                                                           \
+    return true;                                                                \
+}                                                                               \
+                                                                                \
+/* O(length - index) */                                                         \
+inline static bool insert_at_##T(struct T##_array_t * arr, size_t index, T val) { \
+    assert(arr != NULL && index <= arr->length);                                \
+    if (arr->length >= arr->capacity && !_array_grow_##T(arr, 1)) return false; \
+    T * data = array_data(*arr);                                                \
+    memmove(data + index + 1, data + index, sizeof(T) * (arr->length - index)); \
+    data[index] = val;                                                          \
+    arr->length++;                                                              \
+    return true;                                                                \
+}                                                                               \
+                                                                                \
+/* Removes the elements [begin, end), O(length - begin) */                      \
+inline static void erase_range_##T(struct T##_array_t * arr, size_t begin, size_t end) { \
+    assert(arr != NULL && begin <= end && end <= arr->length);                  \
+    T * data = array_data(*arr);                                                \
+    memmove(data + begin, data + end, sizeof(T) * (arr->length - end));         \
+    arr->length -= end - begin;                                                 \
+    _array_shrink_##T(arr);                                                     \
+}                                                                               \
+                                                                                \
+inline static T pop_##T(struct T##_array_t * arr) {                             \
+    assert(arr != NULL && arr->length > 0);                                     \
+    _STATS_ADD(_array_stats.pops, 1);                                           \
+    T ans = array_data(*arr)[--(arr->length)];                                  \
+    _array_shrink_##T(arr);                                                     \
+    return ans;                                                                 \
+}                                                                               \
+                                                                                \
+typedef struct T##_array_t T##_array_t
+
+#define array_t(T) T##_array_t
+#define create_array(T, length, capacity) create_array_##T((length), (capacity))
+#define delete_array(T, arr) delete_array_##T((arr))
+#define open_array(T, path) open_array_##T((path))
+#define sync_array(T, arr) sync_array_##T((arr))
+#define reserve(T, arr, capacity) reserve_##T((arr), (capacity))
+#define append(T, arr, val) append_##T((arr), (val))
+#define append_n(T, arr, vals, n) append_n_##T((arr), (vals), (n))
+#define extend(T, arr, other) extend_##T((arr), (other))
+#define insert_at(T, arr, index, val) insert_at_##T((arr), (index), (val))
+#define erase_range(T, arr, begin, end) erase_range_##T((arr), (begin), (end))
+#define pop(T, arr) pop_##T((arr))
+#define array_data(arr) ((arr).addr != NULL ? (arr).addr : (arr).small)
+#define at(arr, index) (array_data(arr)[index])
+
+#define ARRAY_PARALLEL_THRESHOLD 65536  // smaller arrays are never split across threads
+#define ARRAY_MAX_CHUNKS 64
+
+void _array_parallel_for(struct thread_pool_t * threads, unsigned count, void (*run)(void * ctx, unsigned i),
+                         void * ctx);
+
+/** Number of chunks to split n elements into, or 0 to stay on the calling thread */
+inline static unsigned _array_chunks(struct thread_pool_t * threads, size_t n) {
+    if (threads == NULL || threads->threads == 0 || n < ARRAY_PARALLEL_THRESHOLD) return 0;
+    return threads->threads + 1 < ARRAY_MAX_CHUNKS ? threads->threads + 1 : ARRAY_MAX_CHUNKS;
+}
+
+#define _ARRAY_LESS(a, b) ((a) < (b))
+#define _ARRAY_SWAP(T, a, b) do { T _swap = (a); (a) = (b); (b) = _swap; } while (0)
+
+/*
+ * USE_ARRAY_ALGORITHMS(T, LESS) adds sorting, searching and reductions over array_t(T),
+ * with the LESS(a, b) macro inlined everywhere; use it after USE_ARRAY(T).
+ * USE_ARRAY_INTEGER_ALGORITHMS(T) is the same for an integer type ordered by <, and sorts
+ * with LSD radix sort. USE_ARRAY_SUM(T, ACC) adds sums accumulated in type ACC.
+ * The parallel_* functions split arrays of at least ARRAY_PARALLEL_THRESHOLD elements into
+ * one chunk per thread of the pool (plus the caller's); a NULL pool runs them sequentially.
+ */
+#define USE_ARRAY_ALGORITHMS(T, LESS)                                           \
+    _USE_ARRAY_INTROSORT(T, LESS)                                               \
+    _USE_ARRAY_ALGORITHMS(T, LESS, _array_introsort_##T)
+
+#define USE_ARRAY_INTEGER_ALGORITHMS(T)                                         \
+    _USE_ARRAY_INTROSORT(T, _ARRAY_LESS)                                        \
+    _USE_ARRAY_RADIX_SORT(T)                                                    \
+    _USE_ARRAY_ALGORITHMS(T, _ARRAY_LESS, _array_radix_sort_##T)
+
+#define _USE_ARRAY_INTROSORT(T, LESS)                                           \
+                                                                                \
+inline static void _array_insertion_sort_##T(T * data, size_t n) {              \
+    for (size_t i = 1; i < n; ++i) {                                            \
+        T x = data[i];                                                          \
+        size_t j = i;                                                           \
+        for (; j > 0 && LESS(x, data[j - 1]); --j) data[j] = data[j - 1];       \
+        data[j] = x;                                                            \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+inline static void _array_sift_down_##T(T * data, size_t i, size_t n) {         \
+    T x = data[i];                                                              \
+    for (size_t child; (child = 2 * i + 1) < n; i = child) {                    \
+        if (child + 1 < n && LESS(data[child], data[child + 1])) ++child;       \
+        if (!LESS(x, data[child])) break;                                       \
+        data[i] = data[child];                                                  \
+    }                                                                           \
+    data[i] = x;                                                                \
+}                                                                               \
+                                                                                \
+inline static void _array_heap_sort_##T(T * data, size_t n) {                   \
+    for (size_t i = n / 2; i-- > 0; ) _array_sift_down_##T(data, i, n);         \
+    for (size_t end = n; end-- > 1; ) {                                         \
+        _ARRAY_SWAP(T, data[0], data[end]);                                     \
+        _array_sift_down_##T(data, 0, end);                                     \
+    }                                                                           \
+}                                                                               \
+                                                                                \
+/* Quicksort on a median of three, heap sort once depth runs out, insertion sort below 16 */ \
+inline static void _array_introsort_depth_##T(T * data, size_t n, unsigned depth) { \
+    while (n > 16) {                                                            \
+        if (depth-- == 0) {                                                     \
+            _array_heap_sort_##T(data, n);                                      \
+            return;                                                             \
+        }                                                                       \
+        size_t mid = n / 2;                                                     \
+        if (LESS(data[mid], data[0])) _ARRAY_SWAP(T, data[mid], data[0]);       \
+        if (LESS(data[n - 1], data[0])) _ARRAY_SWAP(T, data[n - 1], data[0]);   \
+        if (LESS(data[n - 1], data[mid])) _ARRAY_SWAP(T, data[n - 1], data[mid]); \
+        T pivot = data[mid];                                                    \
+        ptrdiff_t i = 0, j = n - 1;                                             \
+        while (i <= j) {                                                        \
+            while (LESS(data[i], pivot)) ++i;                                   \
+            while (LESS(pivot, data[j])) --j;                                   \
+            if (i <= j) {                                                       \
+                _ARRAY_SWAP(T, data[i], data[j]);                               \
+                ++i;                                                            \
+                --j;                                                            \
+            }                                                                   \
+        }                                                                       \
+        /* [0, j] and [i, n) are left to sort: recurse into the smaller one */  \
+        if ((size_t)(j + 1) < n - i) {                                          \
+            _array_introsort_depth_##T(data, j + 1, depth);                     \
+            data += i;                                                          \
+            n -= i;                                                             \
+        } else {                                                                \
+            _array_introsort_depth_##T(data + i, n - i, depth);                 \
+            n = j + 1;                                                          \
+        }                                                                       \
+    }                                                                           \
+    _array_insertion_sort_##T(data, n);                                         \
+}                                                                               \
+                                                                                \
+inline static void _array_introsort_##T(T * data, size_t n) {                   \
+    unsigned depth = 0;                                                         \
+    for (size_t m = n; m > 1; m >>= 1) depth += 2;                              \
+    _array_introsort_depth_##T(data, n, depth);                                 \
+}
+
+/* T is an integer type of at most 8 bytes */
+#define _USE_ARRAY_RADIX_SORT(T)                                                \
+                                                                                \
+/* Orders like T: the sign bit of a signed T is flipped */                      \
+inline static uint64_t _array_radix_key_##T(T x) {                              \
+    uint64_t key = (uint64_t)x;                                                 \
+    if ((T)-1 < (T)1) key ^= (uint64_t)1 << (8 * sizeof(T) - 1);  /* signed T */ \
+    return key;                                                                 \
+}                                                                               \
+                                                                                \
+/* LSD radix sort on bytes, O(n * sizeof(T)); bytes all elements share are skipped */ \
+inline static void _array_radix_sort_##T(T * data, size_t n) {                  \
+    if (n < 64) {                                                               \
+        _array_introsort_##T(data, n);                                          \
+        return;                                                                 \
+    }                                                                           \
+    size_t counts[sizeof(T)][256];                                              \
+    memset(counts, 0, sizeof(counts));                                          \
+    for (size_t i = 0; i < n; ++i) {                                            \
+        uint64_t key = _array_radix_key_##T(data[i]);                           \
+        for (unsigned b = 0; b < sizeof(T); ++b) counts[b][(key >> (8 * b)) & 0xff]++; \
+    }                                                                           \
+    T * buffer = malloc(sizeof(T) * n);                                         \
+    assert(buffer != NULL);                                                     \
+    T * src = data, * dst = buffer;                                             \
+    for (unsigned b = 0; b < sizeof(T); ++b) {                                  \
+        size_t * count = counts[b];                                             \
+        if (count[(_array_radix_key_##T(src[0]) >> (8 * b)) & 0xff] == n) continue; \
+        size_t offset = 0;                                                      \
+        for (unsigned d = 0; d < 256; ++d) {                                    \
+            size_t c = count[d];                                                \
+            count[d] = offset;                                                  \
+            offset += c;                                                        \
+        }                                                                       \
+        for (size_t i = 0; i < n; ++i) {                                        \
+            dst[count[(_array_radix_key_##T(src[i]) >> (8 * b)) & 0xff]++] = src[i]; \
+        }                                                                       \
+        _ARRAY_SWAP(T *, src, dst);                                             \
+    }                                                                           \
+    if (src != data) memcpy(data, src, sizeof(T) * n);                          \
+    free(buffer);                                                               \
+}
+
+#define _USE_ARRAY_ALGORITHMS(T, LESS, SORT)                                    \
+                                                                                \
+inline static void sort_##T(struct T##_array_t * arr) {                         \
+    assert(arr != NULL);                                                        \
+    SORT(array_data(*arr), arr->length);                                        \
+}                                                                               \
+                                                                                \
+/* First index whose element is not less than key, or length; needs a sorted array */ \
+inline static size_t lower_bound_##T(const struct T##_array_t * arr, T key) {   \
+    assert(arr != NULL);                                                        \
+    const T * first = array_data(*arr), * base = first;                         \
+    size_t n = arr->length;                                                     \
+    if (n == 0) return 0;                                                       \
+    while (n > 1) {  /* a conditional move per level instead of a mispredicted branch */ \
+        size_t half = n / 2;                                                    \
+        base = LESS(base[half], key) ? base + half : base;                      \
+        n -= half;                                                              \
+    }                                                                           \
+    return base - first + LESS(*base, key);                                     \
+}                                                                               \
+                                                                                \
+inline static T min_##T(const struct T##_array_t * arr) {                       \
+    assert(arr != NULL && arr->length > 0);                                     \
+    const T * data = array_data(*arr);                                          \
+    T ans = data[0];                                                            \
+    for (size_t i = 1; i < arr->length; ++i) ans = LESS(data[i], ans) ? data[i] : ans; \
+    return ans;                                                                 \
+}                                                                               \
+                                                                                \
+inline static T max_##T(const struct T##_array_t * arr) {                       \
+    assert(arr != NULL && arr->length > 0);                                     \
+    const T * data = array_data(*arr);                                          \
+    T ans = data[0];                                                            \
+    for (size_t i = 1; i < arr->length; ++i) ans = LESS(ans, data[i]) ? data[i] : ans; \
+    return ans;                                                                 \
+}                                                                               \
+                                                                                \
+inline static size_t _array_count_if_##T(const T * data, size_t n, bool (*pred)(T)) { \
+    size_t count = 0;                                                           \
+    for (size_t i = 0; i < n; ++i) count += pred(data[i]);                      \
+    return count;                                                               \
+}                                                                               \
+                                                                                \
+inline static size_t count_if_##T(const struct T##_array_t * arr, bool (*pred)(T)) { \
+    assert(arr != NULL && pred != NULL);                                        \
+    return _array_count_if_##T(array_data(*arr), arr->length, pred);            \
+}                                                                               \
+                                                                                \
+struct _array_job_##T {                                                         \
+    T * src, * dst;                                                             \
+    size_t bounds[ARRAY_MAX_CHUNKS + 1];  /* chunk i is [bounds[i], bounds[i + 1]) */ \
+    bool (*pred)(T);                                                            \
+    size_t counts[ARRAY_MAX_CHUNKS];                                            \
+};                                                                              \
+                                                                                \
+static void _array_sort_chunk_##T(void * ctx, unsigned i) {                     \
+    struct _array_job_##T * job = ctx;                                          \
+    SORT(job->src + job->bounds[i], job->bounds[i + 1] - job->bounds[i]);       \
+}                                                                               \
+                                                                                \
+/* Merges chunks 2i and 2i + 1 of src into dst */                               \
+static void _array_merge_chunks_##T(void * ctx, unsigned i) {                   \
+    struct _array_job_##T * job = ctx;                                          \
+    size_t a = job->bounds[2 * i], mid = job->bounds[2 * i + 1], b = mid, end = job->bounds[2 * i + 2]; \
+    size_t out = a;                                                             \
+    while (a < mid && b < end) {                                                \
+        job->dst[out++] = LESS(job->src[b], job->src[a]) ? job->src[b++] : job->src[a++]; \
+    }                                                                           \
+    memcpy(job->dst + out, job->src + a, sizeof(T) * (mid - a));                \
+    memcpy(job->dst + out + (mid - a), job->src + b, sizeof(T) * (end - b));    \
+}                                                                               \
+                                                                                \
+static void _array_count_chunk_##T(void * ctx, unsigned i) {                    \
+    struct _array_job_##T * job = ctx;                                          \
+    job->counts[i] = _array_count_if_##T(job->src + job->bounds[i], job->bounds[i + 1] - job->bounds[i], job->pred); \
+}                                                                               \
+                                                                                \
+inline static void _array_job_init_##T(struct _array_job_##T * job, T * data, size_t n, unsigned chunks) { \
+    job->src = data;                                                            \
+    for (unsigned i = 0; i <= chunks; ++i) job->bounds[i] = n / chunks * i + (i < n % chunks ? i : n % chunks); \
+}                                                                               \
+                                                                                \
+/* Sorts one chunk per thread, then merges pairs of sorted chunks in parallel rounds */ \
+inline static void parallel_sort_##T(struct T##_array_t * arr, struct thread_pool_t * threads) { \
+    assert(arr != NULL);                                                        \
+    T * data = array_data(*arr);                                                \
+    size_t n = arr->length;                                                     \
+    unsigned chunks = _array_chunks(threads, n);                                \
+    T * buffer = chunks > 0 ? malloc(sizeof(T) * n) : NULL;                     \
+    if (buffer == NULL) { /* one thread, or no memory to merge into */          \
+        SORT(data, n);                                                          \
+        return;                                                                 \
+    }                                                                           \
+    struct _array_job_##T job;                                                  \
+    _array_job_init_##T(&job, data, n, chunks);                                 \
+    _array_parallel_for(threads, chunks, _array_sort_chunk_##T, &job);          \
+    job.dst = buffer;                                                           \
+    while (chunks > 1) {                                                        \
+        if (chunks % 2 == 1) { /* the odd chunk out merges with nothing */      \
+            job.bounds[chunks + 1] = n;                                         \
+            chunks++;                                                           \
+        }                                                                       \
+        _array_parallel_for(threads, chunks / 2, _array_merge_chunks_##T, &job); \
+        chunks /= 2;                                                            \
+        for (unsigned i = 0; i <= chunks; ++i) job.bounds[i] = job.bounds[2 * i]; \
+        _ARRAY_SWAP(T *, job.src, job.dst);                                     \
+    }                                                                           \
+    if (job.src != data) memcpy(data, job.src, sizeof(T) * n);                  \
+    free(buffer);                                                               \
+}                                                                               \
+                                                                                \
+inline static size_t parallel_count_if_##T(const struct T##_array_t * arr, bool (*pred)(T), \
+                                           struct thread_pool_t * threads) {    \
+    assert(arr != NULL && pred != NULL);                                        \
+    unsigned chunks = _array_chunks(threads, arr->length);                      \
+    if (chunks == 0) return count_if_##T(arr, pred);                            \
+    struct _array_job_##T job;                                                  \
+    _array_job_init_##T(&job, (T *)array_data(*arr), arr->length, chunks);      \
+    job.pred = pred;                                                            \
+    _array_parallel_for(threads, chunks, _array_count_chunk_##T, &job);         \
+    size_t count = 0;                                                           \
+    for (unsigned i = 0; i < chunks; ++i) count += job.counts[i];               \
+    return count;                                                               \
+}
+
+/* Four independent accumulators, so the loop vectorizes without reassociation */
+#define USE_ARRAY_SUM(T, ACC)                                                   \
+                                                                                \
+inline static ACC _array_sum_##T(const T * data, size_t n) {                    \
+    ACC acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;                                 \
+    size_t i = 0;                                                               \
+    for (; i + 4 <= n; i += 4) {                                                \
+        acc0 += data[i];                                                        \
+        acc1 += data[i + 1];                                                    \
+        acc2 += data[i + 2];                                                    \
+        acc3 += data[i + 3];                                                    \
+    }                                                                           \
+    for (; i < n; ++i) acc0 += data[i];                                         \
+    return (acc0 + acc1) + (acc2 + acc3);                                       \
+}                                                                               \
+                                                                                \
+inline static ACC sum_##T(const struct T##_array_t * arr) {                     \
+    assert(arr != NULL);                                                        \
+    return _array_sum_##T(array_data(*arr), arr->length);                       \
+}                                                                               \
+                                                                                \
+struct _array_sum_job_##T {                                                     \
+    const T * data;                                                             \
+    size_t n;                                                                   \
+    unsigned chunks;                                                            \
+    ACC sums[ARRAY_MAX_CHUNKS];                                                 \
+};                                                                              \
+                                                                                \
+static void _array_sum_chunk_##T(void * ctx, unsigned i) {                      \
+    struct _array_sum_job_##T * job = ctx;                                      \
+    size_t lo = job->n / job->chunks * i, hi = i + 1 == job->chunks ? job->n : lo + job->n / job->chunks; \
+    job->sums[i] = _array_sum_##T(job->data + lo, hi - lo);                     \
+}                                                                               \
+                                                                                \
+inline static ACC parallel_sum_##T(const struct T##_array_t * arr, struct thread_pool_t * threads) { \
+    assert(arr != NULL);                                                        \
+    struct _array_sum_job_##T job;                                              \
+    job.chunks = _array_chunks(threads, arr->length);                           \
+    if (job.chunks == 0) return sum_##T(arr);                                   \
+    job.data = array_data(*arr);                                                \
+    job.n = arr->length;                                                        \
+    _array_parallel_for(threads, job.chunks, _array_sum_chunk_##T, &job);       \
+    ACC sum = 0;                                                                \
+    for (unsigned i = 0; i < job.chunks; ++i) sum += job.sums[i];               \
+    return sum;                                                                 \
+}
+
+#define sort(T, arr) sort_##T((arr))
+#define lower_bound(T, arr, key) lower_bound_##T((arr), (key))
+#define parallel_sort(T, arr, threads) parallel_sort_##T((arr), (threads))
+
+#endif
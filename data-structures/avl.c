@@ -1,200 +1,124 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "avl_int.h"
 
+#define _AVL_CACHE_LINE 64
 
-typedef int T;
+#ifdef DS_STATS
+struct avl_stats_t _avl_stats;
 
-struct avl_node_t {
-    int key;
-    T val;
-    struct avl_node_t * left, * right;
-    int height;
-};
-
-struct avl_tree_t {
-    struct avl_node_t * root;
-    unsigned size;
-};
-
-struct avl_tree_t create_avl_tree(void) {
-    struct avl_tree_t tree;
-    tree.root = NULL;
-    tree.size = 0;
-    return tree;
-}
-
-void _destroy_avl_tree(struct avl_node_t * tree) {
-    assert(tree != NULL);
-    if (tree->left != NULL) _destroy_avl_tree(tree->left);
-    if (tree->right != NULL) _destroy_avl_tree(tree->right);
-    free(tree);
-}
-
-void clear_avl_tree(struct avl_tree_t * tree) {
-    _destroy_avl_tree(tree->root);
-    tree->root = NULL;
-    tree->size = 0;
+/** Counters of all trees generated by USE_AVL_NAMED, see stats.h */
+struct avl_stats_t avl_stats(void) {
+    return _avl_stats_read(&_avl_stats);
 }
+#endif
 
-#define _AVL_HEIGHT(tree) ((tree) ? (tree)->height : -1)
-
-inline static void _avl_update_height(struct avl_node_t * tree) { // tree != NULL
-    int left_height = _AVL_HEIGHT(tree->left);
-    int right_height = _AVL_HEIGHT(tree->right);
-    tree->height = (left_height > right_height ? left_height : right_height) + 1;
+/** Lays sorted[] out so that slot k has children 2k and 2k+1 */
+static void _avl_eytzinger(struct frozen_avl_tree_t * frozen, struct avl_node_t ** sorted, unsigned * next,
+                           unsigned k) {
+    if (k > frozen->size) return;
+    _avl_eytzinger(frozen, sorted, next, 2 * k);
+    frozen->keys[k] = sorted[*next]->key;
+    frozen->nodes[k] = sorted[(*next)++];
+    _avl_eytzinger(frozen, sorted, next, 2 * k + 1);
 }
 
-inline static struct avl_node_t * _avl_left_rotate(struct avl_node_t * tree) {
-    struct avl_node_t * rotated = tree->right;
-    tree->right = rotated->left;
-    _avl_update_height(tree);
-    rotated->left = tree;
-    _avl_update_height(rotated);
-    return rotated;
+/** O(n) */
+struct frozen_avl_tree_t avl_freeze(struct avl_tree_t * tree) {
+    assert(tree != NULL);
+    struct frozen_avl_tree_t frozen;
+    frozen.size = tree->size;
+    size_t bytes = sizeof(int) * (tree->size + 1);
+    bytes = (bytes + _AVL_CACHE_LINE - 1) / _AVL_CACHE_LINE * _AVL_CACHE_LINE;
+    frozen.keys = aligned_alloc(_AVL_CACHE_LINE, bytes);
+    frozen.nodes = malloc(sizeof(struct avl_node_t *) * (tree->size + 1));
+    struct avl_node_t ** sorted = malloc(sizeof(struct avl_node_t *) * (tree->size + 1));
+    assert(frozen.keys != NULL && frozen.nodes != NULL && sorted != NULL);
+    unsigned count = 0;
+    _avl_collect(tree->root, sorted, &count);
+    assert(count == tree->size);
+    count = 0;
+    _avl_eytzinger(&frozen, sorted, &count, 1);
+    free(sorted);
+    return frozen;
+}
+
+/** Returns the address of a node with given key, or NULL if not found */
+struct avl_node_t * frozen_avl_search(const struct frozen_avl_tree_t * frozen, int key) {
+    assert(frozen != NULL);
+    unsigned k = 1;
+    while (k <= frozen->size) {
+        // the 16 slots 4 levels below k share one cache line
+        __builtin_prefetch(frozen->keys + 16 * k);
+        k = 2 * k + (frozen->keys[k] < key);
+    }
+    k >>= __builtin_ffs(~k);  // undo the right turns taken after the last left turn
+    return k != 0 && frozen->keys[k] == key ? frozen->nodes[k] : NULL;
 }
 
-inline static struct avl_node_t * _avl_right_rotate(struct avl_node_t * tree) {
-    struct avl_node_t * rotated = tree->left;
-    tree->left = rotated->right;
-    _avl_update_height(tree);
-    rotated->right = tree;
-    _avl_update_height(rotated);
-    return rotated;
+void clear_frozen_avl_tree(struct frozen_avl_tree_t * frozen) {
+    assert(frozen != NULL);
+    free(frozen->keys);
+    free(frozen->nodes);
+    frozen->keys = NULL;
+    frozen->nodes = NULL;
+    frozen->size = 0;
 }
 
-struct avl_node_t * _avl_maintain(struct avl_node_t * tree) {
-    _avl_update_height(tree);
-    struct avl_node_t * left = tree->left, * right = tree->right;
-    if (_AVL_HEIGHT(left) > _AVL_HEIGHT(right) + 1) {
-        if (_AVL_HEIGHT(left->left) >= _AVL_HEIGHT(left->right)) {
-            return _avl_right_rotate(tree);
-        } else {
-            tree->left = _avl_left_rotate(tree->left);
-            return _avl_right_rotate(tree);
-        }
-    } else if (_AVL_HEIGHT(left) + 1 < _AVL_HEIGHT(right)) {
-        if (_AVL_HEIGHT(right->right) >= _AVL_HEIGHT(right->left)) {
-            return _avl_left_rotate(tree);
-        } else {
-            tree->right = _avl_right_rotate(tree->right);
-            return _avl_left_rotate(tree);
-        }
-    } else {
-        return tree;
-    }
-}
+struct _avl_batch_item_t {
+    int key;
+    unsigned index;
+};
 
-struct avl_node_t * _avl_insert(struct avl_node_t * tree, struct avl_node_t * node, unsigned * size) {
-    if (node->key < tree->key) {
-        if (tree->left != NULL) {
-            tree->left = _avl_insert(tree->left, node, size);
-        } else {
-            tree->left = node;
-            ++(*size);
-        }
-    } else if (tree->key < node->key) {
-        if (tree->right != NULL) {
-            tree->right = _avl_insert(tree->right, node, size);
-        } else {
-            tree->right = node;
-            ++(*size);
-        }
-    } else {
-        free(node);
-    }
-    return tree = _avl_maintain(tree);
+static int _avl_batch_cmp(const void * a, const void * b) {
+    const struct _avl_batch_item_t * x = a, * y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;  // earlier entries win on duplicates
 }
 
 /**
- * Returns the address of inserted node, or NULL if tree already contains the same key
- * When duplicate, values won't be updated
+ * Inserts n unsorted keys, returns how many were new
+ * Values of keys already in the tree won't be updated. A batch that is large relative to the
+ * tree is sorted and merged with an in-order walk of the tree, then rebuilt in O(n + m).
  */
-struct avl_node_t * avl_insert(struct avl_tree_t * tree, int key, T value) {
+unsigned avl_batch_insert(struct avl_tree_t * tree, const int * keys, const T * values, unsigned n) {
     assert(tree != NULL);
-    // create a new node
-    struct avl_node_t * new_node = malloc(sizeof(struct avl_node_t));
-    assert(new_node != NULL);
-    new_node->key = key;
-    new_node->val = value;
-    new_node->left = new_node->right = NULL;
-    new_node->height = 0;
-    // insert
-    if (tree->root == NULL) {
-        tree->size = 1;
-        tree->root = new_node;
-    } else {
-        unsigned old_size = tree->size;
-        tree->root = _avl_insert(tree->root, new_node, &(tree->size));
-        if (tree->size == old_size) new_node = NULL;
+    unsigned old_size = tree->size;
+    unsigned depth = 32 - __builtin_clz(tree->size | 1);
+    if ((unsigned long long)n * depth < tree->size) {
+        for (unsigned i = 0; i < n; ++i) avl_insert(tree, keys[i], values[i]);
+        return tree->size - old_size;
     }
-    return new_node;
-}
-
-/** Returns the address of a node with given key */
-struct avl_node_t * avl_search(struct avl_tree_t * tree, int key) {
-    assert(tree != NULL);
-    struct avl_node_t * cursor = tree->root;
-    while (cursor != NULL) {
-        if (key < cursor->key) cursor = cursor->left;
-        else if (cursor->key < key) cursor = cursor->right;
-        else break;
-    }
-    return cursor;
-}
-
-struct avl_node_t * _avl_min(struct avl_node_t * tree) {
-    assert(tree != NULL);
-    while (tree->left != NULL)
-        tree = tree->left;
-    return tree;
-}
-
-/** Note that min node is not deleted using free() intentionally */
-struct avl_node_t * _avl_exclude_min(struct avl_node_t * tree) {
-    assert(tree != NULL);
-    if (tree->left == NULL) { // current node excluded but not deleted
-        tree = tree->right;
-    } else {
-        // min in left subtree
-        tree->left = _avl_exclude_min(tree->left);
-        tree = _avl_maintain(tree);
+    struct _avl_batch_item_t * batch = malloc(sizeof(struct _avl_batch_item_t) * (n + 1));
+    struct avl_node_t ** existing = malloc(sizeof(struct avl_node_t *) * (tree->size + 1));
+    struct avl_node_t ** merged = malloc(sizeof(struct avl_node_t *) * (tree->size + n + 1));
+    assert(batch != NULL && existing != NULL && merged != NULL);
+    for (unsigned i = 0; i < n; ++i) {
+        batch[i].key = keys[i];
+        batch[i].index = i;
     }
-    return tree;
-}
-
-// Reference: Algorithms (4th ed.) by R. Sedgewick & K. Wayne
-struct avl_node_t * _avl_delete(struct avl_node_t * tree, int key) {
-    // if (tree == NULL) return NULL;  // nothing deleted
-    assert(tree != NULL);  // inexistent key causes an assertion error
-    if (key < tree->key) {
-        tree->left = _avl_delete(tree->left, key);
-        tree = _avl_maintain(tree);
-    } else if (tree->key < key) {
-        tree->right = _avl_delete(tree->right, key);
-        tree = _avl_maintain(tree);
-    } else { // delete current node
-        struct avl_node_t * current = tree;
-        if (current->right == NULL) {
-            tree = current->left;
-        } else if (current->left == NULL) {
-            tree = current->right;
-        } else { // we know that right subtree is not empty
-            tree = _avl_min(current->right);  // find successor
-            tree->right = _avl_exclude_min(current->right); // successor deleted
-            tree->left = current->left;
-            tree = _avl_maintain(tree);
+    qsort(batch, n, sizeof(struct _avl_batch_item_t), _avl_batch_cmp);
+    unsigned count = 0;
+    _avl_collect(tree->root, existing, &count);
+    unsigned i = 0, j = 0, size = 0;
+    while (i < count || j < n) {
+        if (j > 0 && j < n && batch[j].key == batch[j - 1].key) {
+            ++j;
+        } else if (j == n || (i < count && existing[i]->key <= batch[j].key)) {
+            if (j < n && existing[i]->key == batch[j].key) ++j;
+            merged[size++] = existing[i++];
+        } else {
+            merged[size++] = _create_avl_node(batch[j].key, values[batch[j].index], _avl_pool(tree));
+            ++j;
         }
-        free(current);
     }
-    return tree;
-}
-
-/** inexistent key will cause an error */
-void avl_delete(struct avl_tree_t * tree, int key) {
-    assert(tree != NULL);
-    tree->root = _avl_delete(tree->root, key);
-    tree->size--;
+    tree->root = _avl_build(merged, 0, size);
+    tree->size = size;
+    free(batch);
+    free(existing);
+    free(merged);
+    return size - old_size;
 }
 
 void avl_print(struct avl_node_t * tree, int height, int branch) {
@@ -206,59 +130,3 @@ void avl_print(struct avl_node_t * tree, int height, int branch) {
     avl_print(tree->left, height + 1, 1);
     avl_print(tree->right, height + 1, 2);
 }
-
-int main() {
-    srand(1);
-    struct avl_tree_t tree = create_avl_tree();
-
-    avl_insert(&tree, 3, 3);
-    avl_insert(&tree, 9, 9);
-    avl_insert(&tree, 4, 4);
-    avl_insert(&tree, 0, 0);
-    avl_insert(&tree, 5, 5);
-    avl_insert(&tree, 2, 2);
-    avl_insert(&tree, 7, 7);
-    avl_insert(&tree, 8, 8);
-    avl_insert(&tree, 1, 1);
-    avl_insert(&tree, 6, 6);
-    avl_print(tree.root, 0, 0); putchar('\n');
-
-    // check insert duplicate
-    // if (avl_insert(&tree, 7, 8) == NULL)
-    //     puts("Failed to insert as expected\n");
-
-    // printf("size=%d\n", tree.size);
-    // avl_delete(&tree, 11);
-    // printf("size=%d\n", tree.size);
-    // avl_print(tree.root, 0); putchar('\n');
-    // clear_avl_tree(&tree);
-
-    avl_delete(&tree, 7);
-    puts("deleted 7:");
-    avl_print(tree.root, 0, 0); putchar('\n');
-
-    avl_delete(&tree, 8);
-    puts("deleted 8:");
-    avl_print(tree.root, 0, 0); putchar('\n');
-
-    // avl_delete(&tree, 3);
-    // puts("deleted 3:");
-    // avl_print(tree.root, 0, 0); putchar('\n');
-
-    // avl_delete(&tree, 5);
-    // puts("deleted 5:");
-    // avl_print(tree.root, 0, 0); putchar('\n');
-
-    // avl_print(tree.root, 0); putchar('\n');
-    clear_avl_tree(&tree);
-
-    // avl_insert(&tree, 3, 3);
-    // avl_insert(&tree, 9, 9);
-    // avl_insert(&tree, 4, 4);
-    // avl_insert(&tree, 0, 0);
-
-    // avl_print(tree.root, 0); putchar('\n');
-    // clear_avl_tree(&tree);
-
-    return 0;
-}
@@ -0,0 +1,562 @@
+#ifndef AVL_H
+#define AVL_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "pool.h"
+#include "stats.h"
+
+/*
+ * USE_AVL(K, V, CMP) generates an ordered map from K to V, in the style of USE_ARRAY:
+ * every function is specialized for K, V and CMP, so comparisons are inlined instead of
+ * going through strcmp() or a function pointer. CMP(a, b) is a macro or inline function
+ * that returns a negative, zero or positive int, like strcmp().
+ *
+ *   #define U64_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+ *   USE_AVL(uint64_t, point_t, U64_CMP);
+ *   uint64_t_point_t_avl_tree_t tree = create_uint64_t_point_t_avl_tree();
+ *   uint64_t_point_t_avl_insert(&tree, 42, p);
+ *
+ * USE_AVL_NAMED(NAME, K, V, CMP) does the same with a chosen prefix: NAME = avl gives
+ * struct avl_node_t, struct avl_tree_t, avl_insert(), avl_search(), avl_iter_next(), ...
+ * USE_AVL_BALANCE(NAME, NODE, STATS) generates only the rebalancing core, for node types that
+ * keep more than a key and a value (see dict.c); it counts into STATS, a struct avl_stats_t.
+ *
+ * Compile with -DAVL_ORDER_STATISTICS to keep a subtree size in every node,
+ * which makes NAME_rank() and NAME_select() O(log n)
+ * Compile with -DDS_STATS, and link avl.c, to get the counters of avl_stats(), see stats.h
+ */
+
+#define AVL_MAX_HEIGHT 64  // an AVL tree of height 64 holds more than 2^44 nodes
+#define AVL_BATCH_LANES 16  // lookups NAME_search_many() keeps in flight
+
+#define _AVL_HEIGHT(tree) ((tree) ? (tree)->height : -1)
+
+/*
+ * Stores a child link in the rebalancing core. A file whose trees are read while they change
+ * (dict.c, for concurrent_dict.c) defines it as a release store before including avl.h.
+ */
+#ifndef _AVL_LINK
+#define _AVL_LINK(link, node) ((link) = (node))
+#endif
+#define _AVL_COUNT(tree) ((tree) ? (tree)->count : 0)
+
+#ifdef AVL_ORDER_STATISTICS
+#define _AVL_COUNT_FIELD unsigned count;  // nodes in this subtree
+#define _AVL_UPDATE_COUNT(tree) ((tree)->count = _AVL_COUNT((tree)->left) + _AVL_COUNT((tree)->right) + 1)
+#else
+#define _AVL_COUNT_FIELD
+#define _AVL_UPDATE_COUNT(tree) ((void)0)
+#endif
+
+#ifdef DS_STATS
+extern struct avl_stats_t _avl_stats;  // of all USE_AVL_NAMED trees, defined in avl.c
+struct avl_stats_t avl_stats(void);
+#endif
+
+/* NODE needs left, right and height fields, and count with AVL_ORDER_STATISTICS */
+#define USE_AVL_BALANCE(NAME, NODE, STATS)                                              \
+                                                                                        \
+inline static void _##NAME##_update_height(NODE * tree) { /* tree != NULL */            \
+    int left_height = _AVL_HEIGHT(tree->left);                                          \
+    int right_height = _AVL_HEIGHT(tree->right);                                        \
+    tree->height = (left_height > right_height ? left_height : right_height) + 1;       \
+    _AVL_UPDATE_COUNT(tree);                                                            \
+}                                                                                       \
+                                                                                        \
+inline static NODE * _##NAME##_left_rotate(NODE * tree) {                               \
+    NODE * rotated = tree->right;                                                       \
+    _STATS_ADD((STATS).rotations, 1);                                                   \
+    _AVL_LINK(tree->right, rotated->left);                                              \
+    _##NAME##_update_height(tree);                                                      \
+    _AVL_LINK(rotated->left, tree);                                                     \
+    _##NAME##_update_height(rotated);                                                   \
+    return rotated;                                                                     \
+}                                                                                       \
+                                                                                        \
+inline static NODE * _##NAME##_right_rotate(NODE * tree) {                              \
+    NODE * rotated = tree->left;                                                        \
+    _STATS_ADD((STATS).rotations, 1);                                                   \
+    _AVL_LINK(tree->left, rotated->right);                                              \
+    _##NAME##_update_height(tree);                                                      \
+    _AVL_LINK(rotated->right, tree);                                                    \
+    _##NAME##_update_height(rotated);                                                   \
+    return rotated;                                                                     \
+}                                                                                       \
+                                                                                        \
+inline static NODE * _##NAME##_maintain(NODE * tree) {                                  \
+    _STATS_ADD((STATS).maintains, 1);                                                   \
+    _##NAME##_update_height(tree);                                                      \
+    NODE * left = tree->left, * right = tree->right;                                    \
+    if (_AVL_HEIGHT(left) > _AVL_HEIGHT(right) + 1) {                                   \
+        if (_AVL_HEIGHT(left->left) >= _AVL_HEIGHT(left->right)) {                      \
+            return _##NAME##_right_rotate(tree);                                        \
+        } else {                                                                        \
+            _AVL_LINK(tree->left, _##NAME##_left_rotate(tree->left));                   \
+            return _##NAME##_right_rotate(tree);                                        \
+        }                                                                               \
+    } else if (_AVL_HEIGHT(left) + 1 < _AVL_HEIGHT(right)) {                            \
+        if (_AVL_HEIGHT(right->right) >= _AVL_HEIGHT(right->left)) {                    \
+            return _##NAME##_left_rotate(tree);                                         \
+        } else {                                                                        \
+            _AVL_LINK(tree->right, _##NAME##_right_rotate(tree->right));                \
+            return _##NAME##_left_rotate(tree);                                         \
+        }                                                                               \
+    } else {                                                                            \
+        return tree;                                                                    \
+    }                                                                                   \
+}                                                                                       \
+                                                                                        \
+inline static NODE * _##NAME##_min(NODE * tree) {                                       \
+    assert(tree != NULL);                                                               \
+    while (tree->left != NULL)                                                          \
+        tree = tree->left;                                                              \
+    return tree;                                                                        \
+}                                                                                       \
+                                                                                        \
+/* Note that min node is not deleted using free() intentionally */                      \
+inline static NODE * _##NAME##_exclude_min(NODE * tree) {                               \
+    assert(tree != NULL);                                                               \
+    if (tree->left == NULL) { /* current node excluded but not deleted */               \
+        tree = tree->right;                                                             \
+    } else {                                                                            \
+        _AVL_LINK(tree->left, _##NAME##_exclude_min(tree->left));                       \
+        tree = _##NAME##_maintain(tree);                                                \
+    }                                                                                   \
+    return tree;                                                                        \
+}                                                                                       \
+                                                                                        \
+inline static void _##NAME##_collect(NODE * tree, NODE ** sorted, unsigned * count) {   \
+    if (tree == NULL) return;                                                           \
+    _##NAME##_collect(tree->left, sorted, count);                                       \
+    sorted[(*count)++] = tree;                                                          \
+    _##NAME##_collect(tree->right, sorted, count);                                      \
+}                                                                                       \
+                                                                                        \
+/* Links sorted[lo, hi) into a perfectly balanced subtree with exact heights */         \
+inline static NODE * _##NAME##_build(NODE ** sorted, unsigned lo, unsigned hi) {        \
+    if (lo >= hi) return NULL;                                                          \
+    unsigned mid = lo + (hi - lo) / 2;                                                  \
+    NODE * tree = sorted[mid];                                                          \
+    tree->left = _##NAME##_build(sorted, lo, mid);                                      \
+    tree->right = _##NAME##_build(sorted, mid + 1, hi);                                 \
+    _##NAME##_update_height(tree);                                                      \
+    return tree;                                                                        \
+}
+
+#ifdef AVL_ORDER_STATISTICS
+#define _USE_AVL_ORDER_STATISTICS(NAME, K, CMP)                                         \
+                                                                                        \
+/* Number of keys less than key */                                                      \
+inline static unsigned NAME##_rank(struct NAME##_tree_t * tree, K key) {                \
+    assert(tree != NULL);                                                               \
+    unsigned rank = 0;                                                                  \
+    struct NAME##_node_t * cursor = tree->root;                                         \
+    while (cursor != NULL) {                                                            \
+        if (CMP(key, cursor->key) <= 0) {                                               \
+            cursor = cursor->left;                                                      \
+        } else {                                                                        \
+            rank += _AVL_COUNT(cursor->left) + 1;                                       \
+            cursor = cursor->right;                                                     \
+        }                                                                               \
+    }                                                                                   \
+    return rank;                                                                        \
+}                                                                                       \
+                                                                                        \
+/* Positions iter at the node of rank i (0-based), and returns it */                    \
+inline static struct NAME##_node_t * NAME##_select(struct NAME##_tree_t * tree, unsigned i, \
+                                                   struct NAME##_iter_t * iter) {       \
+    assert(tree != NULL && iter != NULL);                                               \
+    _##NAME##_iter_init(iter, tree);                                                    \
+    struct NAME##_node_t * cursor = tree->root;                                         \
+    while (cursor != NULL) {                                                            \
+        iter->path[iter->depth++] = cursor;                                             \
+        unsigned left = _AVL_COUNT(cursor->left);                                       \
+        if (i < left) {                                                                 \
+            cursor = cursor->left;                                                      \
+        } else if (i > left) {                                                          \
+            i -= left + 1;                                                              \
+            cursor = cursor->right;                                                     \
+        } else {                                                                        \
+            return cursor;                                                              \
+        }                                                                               \
+    }                                                                                   \
+    iter->depth = 0;                                                                    \
+    return NULL;                                                                        \
+}
+#else
+#define _USE_AVL_ORDER_STATISTICS(NAME, K, CMP)
+#endif
+
+#define USE_AVL_NAMED(NAME, K, V, CMP)                                                  \
+                                                                                        \
+struct NAME##_node_t {                                                                  \
+    K key;                                                                              \
+    V val;                                                                              \
+    struct NAME##_node_t * left, * right;                                               \
+    int height;                                                                         \
+    _AVL_COUNT_FIELD                                                                    \
+};                                                                                      \
+                                                                                        \
+struct NAME##_tree_t {                                                                  \
+    struct NAME##_node_t * root;                                                        \
+    unsigned size;                                                                      \
+    struct pool_t pool;  /* nodes come from here if pool.obj_size > 0 */                \
+};                                                                                      \
+                                                                                        \
+USE_AVL_BALANCE(NAME, struct NAME##_node_t, _avl_stats)                                 \
+                                                                                        \
+inline static struct NAME##_tree_t create_##NAME##_tree(void) {                         \
+    struct NAME##_tree_t tree;                                                          \
+    tree.root = NULL;                                                                   \
+    tree.size = 0;                                                                      \
+    tree.pool.obj_size = 0;                                                             \
+    return tree;                                                                        \
+}                                                                                       \
+                                                                                        \
+/* Nodes of the returned tree are carved from per-tree slabs */                         \
+inline static struct NAME##_tree_t create_##NAME##_tree_pooled(void) {                  \
+    struct NAME##_tree_t tree = create_##NAME##_tree();                                 \
+    tree.pool = create_pool(sizeof(struct NAME##_node_t));                              \
+    return tree;                                                                        \
+}                                                                                       \
+                                                                                        \
+inline static struct pool_t * _##NAME##_pool(struct NAME##_tree_t * tree) {             \
+    return tree->pool.obj_size > 0 ? &tree->pool : NULL;                                \
+}                                                                                       \
+                                                                                        \
+inline static struct NAME##_node_t * _create_##NAME##_node(K key, V value, struct pool_t * pool) { \
+    struct NAME##_node_t * new_node = pool ? pool_alloc(pool) : malloc(sizeof(struct NAME##_node_t)); \
+    assert(new_node != NULL);                                                           \
+    _STATS_ADD(_avl_stats.allocations, 1);                                              \
+    _STATS_ADD(_avl_stats.bytes_allocated, sizeof(struct NAME##_node_t));               \
+    new_node->key = key;                                                                \
+    new_node->val = value;                                                              \
+    new_node->left = new_node->right = NULL;                                            \
+    _##NAME##_update_height(new_node);                                                  \
+    return new_node;                                                                    \
+}                                                                                       \
+                                                                                        \
+inline static void _destroy_##NAME##_node(struct NAME##_node_t * node, struct pool_t * pool) { \
+    if (pool) pool_free(pool, node);                                                    \
+    else free(node);                                                                    \
+}                                                                                       \
+                                                                                        \
+inline static void _destroy_##NAME##_tree(struct NAME##_node_t * tree) {                \
+    assert(tree != NULL);                                                               \
+    if (tree->left != NULL) _destroy_##NAME##_tree(tree->left);                         \
+    if (tree->right != NULL) _destroy_##NAME##_tree(tree->right);                       \
+    free(tree);                                                                         \
+}                                                                                       \
+                                                                                        \
+/* O(#slabs) for pooled trees, O(n) otherwise */                                        \
+inline static void clear_##NAME##_tree(struct NAME##_tree_t * tree) {                   \
+    assert(tree != NULL);                                                               \
+    if (tree->pool.obj_size > 0) {                                                      \
+        pool_clear(&tree->pool);                                                        \
+    } else if (tree->root != NULL) {                                                    \
+        _destroy_##NAME##_tree(tree->root);                                             \
+    }                                                                                   \
+    tree->root = NULL;                                                                  \
+    tree->size = 0;                                                                     \
+}                                                                                       \
+                                                                                        \
+/* Descends once; only the path of a real insertion is rebalanced */                    \
+inline static struct NAME##_node_t * _##NAME##_insert(struct NAME##_node_t * tree, K key, V value, \
+        struct NAME##_node_t ** found, unsigned * size, struct pool_t * pool) {         \
+    if (tree == NULL) {                                                                 \
+        ++(*size);                                                                      \
+        return *found = _create_##NAME##_node(key, value, pool);                        \
+    }                                                                                   \
+    unsigned old_size = *size;                                                          \
+    int cmp = CMP(key, tree->key);                                                      \
+    if (cmp < 0) {                                                                      \
+        tree->left = _##NAME##_insert(tree->left, key, value, found, size, pool);       \
+    } else if (cmp > 0) {                                                               \
+        tree->right = _##NAME##_insert(tree->right, key, value, found, size, pool);     \
+    } else {                                                                            \
+        *found = tree;                                                                  \
+    }                                                                                   \
+    return *size == old_size ? tree : _##NAME##_maintain(tree);                         \
+}                                                                                       \
+                                                                                        \
+/*                                                                                      \
+ * Returns the address of the value stored under key, inserting value first if key is   \
+ * absent; *inserted (if not NULL) tells whether a node was created                     \
+ */                                                                                     \
+inline static V * NAME##_find_or_insert(struct NAME##_tree_t * tree, K key, V value, bool * inserted) { \
+    assert(tree != NULL);                                                               \
+    unsigned old_size = tree->size;                                                     \
+    struct NAME##_node_t * found = NULL;                                                \
+    tree->root = _##NAME##_insert(tree->root, key, value, &found, &tree->size, _##NAME##_pool(tree)); \
+    if (inserted != NULL) *inserted = tree->size != old_size;                           \
+    return &found->val;                                                                 \
+}                                                                                       \
+                                                                                        \
+/*                                                                                      \
+ * Returns the address of inserted node, or NULL if tree already contains the same key  \
+ * When duplicate, values won't be updated                                              \
+ */                                                                                     \
+inline static struct NAME##_node_t * NAME##_insert(struct NAME##_tree_t * tree, K key, V value) { \
+    assert(tree != NULL);                                                               \
+    unsigned old_size = tree->size;                                                     \
+    struct NAME##_node_t * found = NULL;                                                \
+    tree->root = _##NAME##_insert(tree->root, key, value, &found, &tree->size, _##NAME##_pool(tree)); \
+    return tree->size != old_size ? found : NULL;                                       \
+}                                                                                       \
+                                                                                        \
+/* Returns the address of a node with given key */                                      \
+inline static struct NAME##_node_t * NAME##_search(struct NAME##_tree_t * tree, K key) { \
+    assert(tree != NULL);                                                               \
+    struct NAME##_node_t * cursor = tree->root;                                         \
+    unsigned depth = 0;                                                                 \
+    while (cursor != NULL) {                                                            \
+        int cmp = CMP(key, cursor->key);                                                \
+        ++depth;                                                                        \
+        if (cmp == 0) break;                                                            \
+        cursor = cmp < 0 ? cursor->left : cursor->right;                                \
+    }                                                                                   \
+    _STATS_LOOKUP(_avl_stats, depth);                                                   \
+    return cursor;                                                                      \
+}                                                                                       \
+                                                                                        \
+/*                                                                                      \
+ * results[i] = NAME_search(tree, keys[i]) for every i < n                              \
+ * Up to AVL_BATCH_LANES descents advance one level per round, each prefetching the     \
+ * child it moves to, so the cache misses of different lookups overlap.                 \
+ */                                                                                     \
+inline static void NAME##_search_many(struct NAME##_tree_t * tree, const K * keys, unsigned n, \
+                                      struct NAME##_node_t ** results) {                \
+    assert(tree != NULL && (n == 0 || (keys != NULL && results != NULL)));              \
+    struct {                                                                            \
+        struct NAME##_node_t * cursor;                                                  \
+        unsigned index;                                                                 \
+        unsigned depth;  /* compares so far, for _STATS_LOOKUP */                       \
+    } lanes[AVL_BATCH_LANES];                                                           \
+    unsigned active = 0, next = 0;                                                      \
+    while (next < n && active < AVL_BATCH_LANES) {                                      \
+        lanes[active].cursor = tree->root;                                              \
+        lanes[active].depth = 0;                                                        \
+        lanes[active++].index = next++;                                                 \
+    }                                                                                   \
+    while (active > 0) {                                                                \
+        for (unsigned i = 0; i < active; ) {                                            \
+            struct NAME##_node_t * cursor = lanes[i].cursor;                            \
+            int cmp = cursor == NULL ? 0 : CMP(keys[lanes[i].index], cursor->key);      \
+            lanes[i].depth += cursor != NULL;                                           \
+            if (cmp != 0) {                                                             \
+                lanes[i].cursor = cmp < 0 ? cursor->left : cursor->right;               \
+                __builtin_prefetch(lanes[i].cursor);                                    \
+                ++i;                                                                    \
+                continue;                                                               \
+            }                                                                           \
+            results[lanes[i].index] = cursor;                                           \
+            _STATS_LOOKUP(_avl_stats, lanes[i].depth);                                  \
+            if (next < n) {  /* the lane starts over with the next key */               \
+                lanes[i].cursor = tree->root;                                           \
+                lanes[i].depth = 0;                                                     \
+                lanes[i++].index = next++;                                              \
+            } else {                                                                    \
+                lanes[i] = lanes[--active];                                             \
+            }                                                                           \
+        }                                                                               \
+    }                                                                                   \
+}                                                                                       \
+                                                                                        \
+/* Reference: Algorithms (4th ed.) by R. Sedgewick & K. Wayne */                        \
+inline static struct NAME##_node_t * _##NAME##_delete(struct NAME##_node_t * tree, K key, \
+                                                      struct pool_t * pool) {           \
+    assert(tree != NULL);  /* inexistent key causes an assertion error */               \
+    int cmp = CMP(key, tree->key);                                                      \
+    if (cmp < 0) {                                                                      \
+        tree->left = _##NAME##_delete(tree->left, key, pool);                           \
+        tree = _##NAME##_maintain(tree);                                                \
+    } else if (cmp > 0) {                                                               \
+        tree->right = _##NAME##_delete(tree->right, key, pool);                         \
+        tree = _##NAME##_maintain(tree);                                                \
+    } else { /* delete current node */                                                  \
+        struct NAME##_node_t * current = tree;                                          \
+        if (current->right == NULL) {                                                   \
+            tree = current->left;                                                       \
+        } else if (current->left == NULL) {                                             \
+            tree = current->right;                                                      \
+        } else { /* we know that right subtree is not empty */                          \
+            tree = _##NAME##_min(current->right);  /* find successor */                 \
+            tree->right = _##NAME##_exclude_min(current->right);                        \
+            tree->left = current->left;                                                 \
+            tree = _##NAME##_maintain(tree);                                            \
+        }                                                                               \
+        _destroy_##NAME##_node(current, pool);                                          \
+    }                                                                                   \
+    return tree;                                                                        \
+}                                                                                       \
+                                                                                        \
+/* inexistent key will cause an error */                                                \
+inline static void NAME##_delete(struct NAME##_tree_t * tree, K key) {                  \
+    assert(tree != NULL);                                                               \
+    tree->root = _##NAME##_delete(tree->root, key, _##NAME##_pool(tree));               \
+    tree->size--;                                                                       \
+}                                                                                       \
+                                                                                        \
+/*                                                                                      \
+ * Fills an empty tree from n keys in ascending order in O(n)                           \
+ * Repeated keys keep their first value, as NAME_insert() would.                        \
+ */                                                                                     \
+inline static void NAME##_build_from_sorted(struct NAME##_tree_t * tree, const K * keys, \
+                                            const V * values, unsigned n) {             \
+    assert(tree != NULL && tree->root == NULL);                                         \
+    struct NAME##_node_t ** sorted = malloc(sizeof(struct NAME##_node_t *) * (n + 1));  \
+    assert(sorted != NULL);                                                             \
+    unsigned count = 0;                                                                 \
+    for (unsigned i = 0; i < n; ++i) {                                                  \
+        assert(i == 0 || CMP(keys[i - 1], keys[i]) <= 0);                               \
+        if (i > 0 && CMP(keys[i - 1], keys[i]) == 0) continue;                          \
+        sorted[count++] = _create_##NAME##_node(keys[i], values[i], _##NAME##_pool(tree)); \
+    }                                                                                   \
+    tree->root = _##NAME##_build(sorted, 0, count);                                     \
+    tree->size = count;                                                                 \
+    free(sorted);                                                                       \
+}                                                                                       \
+                                                                                        \
+/*                                                                                      \
+ * Cursor over a tree in key order, holding the path from the root to the current node  \
+ * Needs no allocation and no parent pointers; any modification of the tree invalidates it. \
+ * Past the last node (or the range) the cursor is at the end: prev() steps back onto it. \
+ */                                                                                     \
+struct NAME##_iter_t {                                                                  \
+    struct NAME##_node_t * path[AVL_MAX_HEIGHT];                                        \
+    int depth;  /* 0 once the cursor has left the tree or its range */                  \
+    bool at_end;  /* depth is 0 because the cursor went past the last node */           \
+    struct NAME##_node_t * root;                                                        \
+    struct NAME##_node_t * begin, * end;  /* range bounds, NULL when unbounded */       \
+};                                                                                      \
+                                                                                        \
+inline static struct NAME##_node_t * _##NAME##_iter_current(struct NAME##_iter_t * iter) { \
+    return iter->depth > 0 ? iter->path[iter->depth - 1] : NULL;                        \
+}                                                                                       \
+                                                                                        \
+inline static void _##NAME##_iter_init(struct NAME##_iter_t * iter, struct NAME##_tree_t * tree) { \
+    iter->depth = 0;                                                                    \
+    iter->at_end = false;                                                               \
+    iter->root = tree->root;                                                            \
+    iter->begin = iter->end = NULL;                                                     \
+}                                                                                       \
+                                                                                        \
+/* Descends from node along left (dir = 0) or right (dir = 1) children */               \
+inline static struct NAME##_node_t * _##NAME##_iter_descend(struct NAME##_iter_t * iter, \
+                                                            struct NAME##_node_t * node, int dir) { \
+    while (node != NULL) {                                                              \
+        iter->path[iter->depth++] = node;                                               \
+        node = dir ? node->right : node->left;                                          \
+    }                                                                                   \
+    return _##NAME##_iter_current(iter);                                                \
+}                                                                                       \
+                                                                                        \
+inline static struct NAME##_node_t * NAME##_iter_first(struct NAME##_tree_t * tree, struct NAME##_iter_t * iter) { \
+    assert(tree != NULL && iter != NULL);                                               \
+    _##NAME##_iter_init(iter, tree);                                                    \
+    return _##NAME##_iter_descend(iter, tree->root, 0);                                 \
+}                                                                                       \
+                                                                                        \
+inline static struct NAME##_node_t * NAME##_iter_last(struct NAME##_tree_t * tree, struct NAME##_iter_t * iter) { \
+    assert(tree != NULL && iter != NULL);                                               \
+    _##NAME##_iter_init(iter, tree);                                                    \
+    return _##NAME##_iter_descend(iter, tree->root, 1);                                 \
+}                                                                                       \
+                                                                                        \
+/* Positions iter at the first node whose key is not less than key, and returns it */   \
+inline static struct NAME##_node_t * NAME##_lower_bound(struct NAME##_tree_t * tree, K key, \
+                                                        struct NAME##_iter_t * iter) {  \
+    assert(tree != NULL && iter != NULL);                                               \
+    _##NAME##_iter_init(iter, tree);                                                    \
+    int found = 0;                                                                      \
+    struct NAME##_node_t * cursor = tree->root;                                         \
+    while (cursor != NULL) {                                                            \
+        iter->path[iter->depth++] = cursor;                                             \
+        if (CMP(key, cursor->key) <= 0) {                                               \
+            found = iter->depth;                                                        \
+            cursor = cursor->left;                                                      \
+        } else {                                                                        \
+            cursor = cursor->right;                                                     \
+        }                                                                               \
+    }                                                                                   \
+    iter->depth = found;                                                                \
+    iter->at_end = found == 0;                                                          \
+    return _##NAME##_iter_current(iter);                                                \
+}                                                                                       \
+                                                                                        \
+/* Positions iter at the first key of [lo, hi); next/prev stay inside the range */      \
+inline static struct NAME##_node_t * NAME##_range(struct NAME##_tree_t * tree, K lo, K hi, \
+                                                  struct NAME##_iter_t * iter) {        \
+    assert(tree != NULL && iter != NULL);                                               \
+    struct NAME##_node_t * end = NAME##_lower_bound(tree, hi, iter);                    \
+    struct NAME##_node_t * begin = NAME##_lower_bound(tree, lo, iter);                  \
+    if (CMP(lo, hi) >= 0 || begin == end) {                                             \
+        iter->depth = 0;                                                                \
+        iter->at_end = false;                                                           \
+        return NULL;                                                                    \
+    }                                                                                   \
+    iter->begin = begin;                                                                \
+    iter->end = end;                                                                    \
+    return begin;                                                                       \
+}                                                                                       \
+                                                                                        \
+inline static struct NAME##_node_t * NAME##_iter_next(struct NAME##_iter_t * iter) {    \
+    assert(iter != NULL);                                                               \
+    if (iter->depth == 0) return NULL;                                                  \
+    struct NAME##_node_t * current = iter->path[iter->depth - 1];                       \
+    if (current->right != NULL) {                                                       \
+        _##NAME##_iter_descend(iter, current->right, 0);                                \
+    } else {  /* climb until we come up from a left child */                            \
+        struct NAME##_node_t * child;                                                   \
+        do {                                                                            \
+            child = iter->path[--iter->depth];                                          \
+        } while (iter->depth > 0 && iter->path[iter->depth - 1]->right == child);       \
+    }                                                                                   \
+    if (iter->depth > 0 && iter->path[iter->depth - 1] == iter->end) iter->depth = 0;   \
+    iter->at_end = iter->depth == 0;                                                    \
+    return _##NAME##_iter_current(iter);                                                \
+}                                                                                       \
+                                                                                        \
+/* Rebuilds the path down to node, which is in the tree */                              \
+inline static void _##NAME##_iter_seek(struct NAME##_iter_t * iter, struct NAME##_node_t * node) { \
+    struct NAME##_node_t * cursor = iter->root;                                         \
+    iter->depth = 0;                                                                    \
+    while (cursor != NULL) {                                                            \
+        iter->path[iter->depth++] = cursor;                                             \
+        int cmp = CMP(node->key, cursor->key);                                          \
+        if (cmp == 0) break;                                                            \
+        cursor = cmp < 0 ? cursor->left : cursor->right;                                \
+    }                                                                                   \
+}                                                                                       \
+                                                                                        \
+inline static struct NAME##_node_t * NAME##_iter_prev(struct NAME##_iter_t * iter) {    \
+    assert(iter != NULL);                                                               \
+    if (iter->at_end) {  /* back onto the last node, or the one before the range end */ \
+        iter->at_end = false;                                                           \
+        if (iter->end == NULL) return _##NAME##_iter_descend(iter, iter->root, 1);      \
+        _##NAME##_iter_seek(iter, iter->end);                                           \
+    }                                                                                   \
+    if (iter->depth == 0) return NULL;                                                  \
+    struct NAME##_node_t * current = iter->path[iter->depth - 1];                       \
+    if (current == iter->begin) {                                                       \
+        iter->depth = 0;                                                                \
+    } else if (current->left != NULL) {                                                 \
+        _##NAME##_iter_descend(iter, current->left, 1);                                 \
+    } else {  /* climb until we come up from a right child */                           \
+        struct NAME##_node_t * child;                                                   \
+        do {                                                                            \
+            child = iter->path[--iter->depth];                                          \
+        } while (iter->depth > 0 && iter->path[iter->depth - 1]->left == child);        \
+    }                                                                                   \
+    return _##NAME##_iter_current(iter);                                                \
+}                                                                                       \
+                                                                                        \
+_USE_AVL_ORDER_STATISTICS(NAME, K, CMP)                                                 \
+                                                                                        \
+typedef struct NAME##_tree_t NAME##_tree_t
+
+#define USE_AVL(K, V, CMP) USE_AVL_NAMED(K##_##V##_avl, K, V, CMP)
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef AVL_INT_H
+#define AVL_INT_H
+
+#include "avl.h"
+
+typedef int T;
+
+#define _AVL_INT_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+
+USE_AVL_NAMED(avl, int, T, _AVL_INT_CMP);
+
+/**
+ * Read-only snapshot of a tree in Eytzinger (breadth-first) order
+ * keys[1..size] sit in one cache-line-aligned array, so the top levels of every search share
+ * a few cache lines and each deeper line is prefetched several levels ahead.
+ * nodes[] point back into the tree: lookups return what avl_search() would, as long as the
+ * tree is neither modified nor cleared while the snapshot is in use.
+ */
+struct frozen_avl_tree_t {
+    int * keys;  // 1-based, keys[0] is padding
+    struct avl_node_t ** nodes;
+    unsigned size;
+};
+
+struct frozen_avl_tree_t avl_freeze(struct avl_tree_t * tree);
+struct avl_node_t * frozen_avl_search(const struct frozen_avl_tree_t * frozen, int key);
+void clear_frozen_avl_tree(struct frozen_avl_tree_t * frozen);
+unsigned avl_batch_insert(struct avl_tree_t * tree, const int * keys, const T * values, unsigned n);
+void avl_print(struct avl_node_t * tree, int height, int branch);
+
+#endif
@@ -0,0 +1,97 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../concurrent_dict.h"
+
+// Mixed workload over KEYS keys: 90% get, 8% set, 2% delete followed by re-insert
+#define KEYS 100000
+#define OPS_PER_THREAD 400000
+#define SHARDS 64
+
+static char keys[KEYS][24];
+
+static dict_t locked_dict;
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+static concurrent_dict_t * sharded_dict;
+
+struct worker_t {
+    pthread_t thread;
+    unsigned seed;
+    int sharded;
+    long found;
+};
+
+static void * run_worker(void * arg) {
+    struct worker_t * worker = arg;
+    for (int i = 0; i < OPS_PER_THREAD; ++i) {
+        unsigned r = rand_r(&worker->seed);
+        const char * key = keys[r % KEYS];
+        unsigned op = (r >> 20) % 100;
+        if (worker->sharded) {
+            if (op < 90) {
+                worker->found += concurrent_dict_get(sharded_dict, key, NULL);
+            } else if (op < 98) {
+                concurrent_dict_set(sharded_dict, key, i);
+            } else if (concurrent_dict_delete(sharded_dict, key)) {
+                concurrent_dict_add(sharded_dict, key, i);
+            }
+        } else {
+            pthread_mutex_lock(&global_lock);
+            if (op < 90) {
+                worker->found += dict_get(locked_dict, key) != NULL;
+            } else if (op < 98) {
+                dict_set(&locked_dict, key, i);
+            } else {
+                struct dict_node_t * node = dict_detach(&locked_dict, key);
+                if (node != NULL) {
+                    dict_release_node(&locked_dict, node);
+                    dict_add(&locked_dict, key, i);
+                }
+            }
+            pthread_mutex_unlock(&global_lock);
+        }
+    }
+    return NULL;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static double measure(int sharded, int threads) {
+    struct worker_t workers[16];
+    double start = now();
+    for (int i = 0; i < threads; ++i) {
+        workers[i].seed = 7 * i + 1;
+        workers[i].sharded = sharded;
+        workers[i].found = 0;
+        pthread_create(&workers[i].thread, NULL, run_worker, workers + i);
+    }
+    for (int i = 0; i < threads; ++i) pthread_join(workers[i].thread, NULL);
+    return (double)threads * OPS_PER_THREAD / (now() - start);
+}
+
+int main(void) {
+    locked_dict = create_dict();
+    sharded_dict = create_concurrent_dict(SHARDS);
+    if (sharded_dict == NULL) {
+        fputs("out of memory\n", stderr);
+        return 1;
+    }
+    for (int i = 0; i < KEYS; ++i) {
+        snprintf(keys[i], sizeof(keys[i]), "user:%08d", i);
+        dict_add(&locked_dict, keys[i], i);
+        concurrent_dict_add(sharded_dict, keys[i], i);
+    }
+    puts("impl,threads,ops_per_sec");
+    for (int threads = 1; threads <= 16; threads *= 2) {
+        printf("global_mutex,%d,%.0f\n", threads, measure(0, threads));
+        printf("sharded_%d,%d,%.0f\n", SHARDS, threads, measure(1, threads));
+    }
+    clear_dict(&locked_dict);
+    destroy_concurrent_dict(sharded_dict);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../avl.h"
+#include "../dict.h"
+
+// Random lookups in batches, as request handlers issue them; half of the keys are absent
+#define LOOKUPS 4000000
+
+#define U64_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+USE_AVL(uint64_t, int, U64_CMP);
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint64_t mix(uint64_t x) {  // splitmix64 finalizer: keys in random tree order
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static void bench_dict(unsigned n, unsigned batch) {
+    char (* keys)[32] = malloc(sizeof(*keys) * 2 * n);
+    const char ** queries = malloc(sizeof(char *) * LOOKUPS);
+    struct dict_node_t ** results = malloc(sizeof(struct dict_node_t *) * batch);
+    dict_t dict = create_dict_pooled();
+    for (unsigned i = 0; i < 2 * n; ++i) {
+        snprintf(keys[i], sizeof(keys[i]), "session:%016llx", (unsigned long long)mix(i));
+        if (i % 2 == 0) dict_add(&dict, keys[i], i);
+    }
+    for (unsigned i = 0; i < LOOKUPS; ++i) queries[i] = keys[mix(i + n) % (2 * n)];
+
+    long found = 0;
+    double start = now();
+    for (unsigned i = 0; i + batch <= LOOKUPS; i += batch) {
+        for (unsigned j = 0; j < batch; ++j) results[j] = dict_get(dict, queries[i + j]);
+        for (unsigned j = 0; j < batch; ++j) found += results[j] != NULL;
+    }
+    double single = now() - start;
+    start = now();
+    for (unsigned i = 0; i + batch <= LOOKUPS; i += batch) {
+        dict_get_many(dict, queries + i, batch, results);
+        for (unsigned j = 0; j < batch; ++j) found -= results[j] != NULL;
+    }
+    double many = now() - start;
+    if (found != 0) fprintf(stderr, "dict_get_many disagrees with dict_get\n");
+    printf("dict_get,%u,%u,%.1f\n", n, batch, single * 1e9 / LOOKUPS);
+    printf("dict_get_many,%u,%u,%.1f\n", n, batch, many * 1e9 / LOOKUPS);
+    clear_dict(&dict);
+    free(keys);
+    free(queries);
+    free(results);
+}
+
+static void bench_avl(unsigned n, unsigned batch) {
+    uint64_t * queries = malloc(sizeof(uint64_t) * LOOKUPS);
+    struct uint64_t_int_avl_node_t ** results = malloc(sizeof(struct uint64_t_int_avl_node_t *) * batch);
+    uint64_t_int_avl_tree_t tree = create_uint64_t_int_avl_tree_pooled();
+    for (unsigned i = 0; i < n; ++i) uint64_t_int_avl_insert(&tree, mix(2 * i), i);
+    for (unsigned i = 0; i < LOOKUPS; ++i) queries[i] = mix(mix(i + n) % (2 * n));
+
+    long found = 0;
+    double start = now();
+    for (unsigned i = 0; i + batch <= LOOKUPS; i += batch) {
+        for (unsigned j = 0; j < batch; ++j) results[j] = uint64_t_int_avl_search(&tree, queries[i + j]);
+        for (unsigned j = 0; j < batch; ++j) found += results[j] != NULL;
+    }
+    double single = now() - start;
+    start = now();
+    for (unsigned i = 0; i + batch <= LOOKUPS; i += batch) {
+        uint64_t_int_avl_search_many(&tree, queries + i, batch, results);
+        for (unsigned j = 0; j < batch; ++j) found -= results[j] != NULL;
+    }
+    double many = now() - start;
+    if (found != 0) fprintf(stderr, "avl_search_many disagrees with avl_search\n");
+    printf("avl_search,%u,%u,%.1f\n", n, batch, single * 1e9 / LOOKUPS);
+    printf("avl_search_many,%u,%u,%.1f\n", n, batch, many * 1e9 / LOOKUPS);
+    clear_uint64_t_int_avl_tree(&tree);
+    free(queries);
+    free(results);
+}
+
+int main(void) {
+    puts("impl,keys,batch,ns_per_lookup");
+    for (unsigned n = 1000; n <= 1000000; n *= 10) {
+        for (unsigned batch = 32; batch <= 256; batch *= 8) {
+            bench_dict(n, batch);
+            bench_avl(n, batch);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,410 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "../array.h"
+#include "../avl.h"
+#include "../dict.h"
+#include "../hash_dict.h"
+
+/*
+ * Insert/lookup/delete over sequential, uniformly random and Zipfian key streams, and
+ * append/pop churn on an array, at 1K keys and every power of ten up to argv[1] (default 1M,
+ * 100M needs about 10 GB for the 64-byte string keys).
+ * Prints one CSV row per operation; diff the output of two commits to spot regressions:
+ *   structure,workload,keys,key_len,op,ops,ops_per_sec,p50_ns,p99_ns,p999_ns,peak_rss_kb
+ * Latencies exclude the cost of reading the clock. Each case runs in its own process, so
+ * peak_rss_kb is that case's high-water mark.
+ */
+#define DEFAULT_MAX_KEYS 1000000
+#define MIN_OPS (1 << 20)   // small cases repeat until every operation ran this often
+#define LATENCY_STRIDE 8    // every 8th operation is timed on its own
+#define ZIPF_THETA 0.99     // as in YCSB
+
+#define U64_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+USE_AVL(uint64_t, uint64_t, U64_CMP);
+USE_ARRAY(int);
+
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static uint64_t timer_overhead;
+
+/** The cheapest back-to-back clock reading, subtracted from every latency sample */
+static void calibrate_timer(void) {
+    timer_overhead = UINT64_MAX;
+    for (unsigned i = 0; i < 10000; ++i) {
+        uint64_t t = now_ns(), elapsed = now_ns() - t;
+        if (elapsed < timer_overhead) timer_overhead = elapsed;
+    }
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t next_random(void) {  // splitmix64
+    uint64_t x = (rng_state += 0x9e3779b97f4a7c15ULL);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/** Log-linear latency histogram: 16 buckets per power of two, so within about 6% */
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+struct histogram_t {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+};
+
+static void hist_add(struct histogram_t * hist, uint64_t ns) {
+    ns = ns > timer_overhead ? ns - timer_overhead : 0;
+    unsigned bucket = ns;
+    if (ns >= (1 << HIST_SUB_BITS)) {
+        unsigned exp = 63 - __builtin_clzll(ns);
+        bucket = ((exp - HIST_SUB_BITS + 1) << HIST_SUB_BITS) | ((ns >> (exp - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+    }
+    hist->counts[bucket]++;
+    hist->total++;
+}
+
+/** Midpoint of the bucket holding quantile q */
+static double hist_quantile(const struct histogram_t * hist, double q) {
+    uint64_t rank = ceil(q * hist->total), seen = 0;
+    for (unsigned bucket = 0; bucket < HIST_BUCKETS; ++bucket) {
+        seen += hist->counts[bucket];
+        if (seen < rank || hist->counts[bucket] == 0) continue;
+        if (bucket < (1 << HIST_SUB_BITS)) return bucket;
+        unsigned exp = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+        uint64_t low = (uint64_t)((1 << HIST_SUB_BITS) | (bucket & ((1 << HIST_SUB_BITS) - 1))) << (exp - HIST_SUB_BITS);
+        return low + (1ULL << (exp - HIST_SUB_BITS)) / 2.0;
+    }
+    return 0;
+}
+
+/** Timing of one operation kind across all rounds of a case */
+struct phase_t {
+    const char * op;
+    struct histogram_t hist;
+    uint64_t ops, elapsed_ns;
+};
+
+struct case_t {
+    const char * structure, * workload;
+    unsigned keys, key_len;
+    struct phase_t phases[3];
+};
+
+static void print_case(const struct case_t * c) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    for (unsigned i = 0; i < 3; ++i) {
+        const struct phase_t * p = c->phases + i;
+        printf("%s,%s,%u,%u,%s,%llu,%.0f,%.0f,%.0f,%.0f,%ld\n", c->structure, c->workload, c->keys, c->key_len,
+               p->op, (unsigned long long)p->ops, p->ops * 1e9 / p->elapsed_ns, hist_quantile(&p->hist, 0.5),
+               hist_quantile(&p->hist, 0.99), hist_quantile(&p->hist, 0.999), usage.ru_maxrss);
+    }
+}
+
+/* Keys: index k maps to the integer k, or to a string of key_len bytes ending in k in hex */
+
+static char * key_arena;
+static unsigned key_stride;
+
+#define KEY(k) (key_arena + (size_t)(k) * key_stride)
+
+static const char KEY_PADDING[] = "tenant-0042/region-eu-west-1/service-checkout/cart/items/entry-";
+
+static void make_keys(unsigned n, unsigned key_len) {
+    key_stride = key_len + 1;
+    key_arena = malloc((size_t)n * key_stride);
+    for (unsigned k = 0; k < n; ++k) {
+        char * key = KEY(k);
+        unsigned digits = key_len < 16 ? key_len : 16;
+        memcpy(key, KEY_PADDING, key_len - digits);
+        for (unsigned j = 0; j < digits; ++j) key[key_len - 1 - j] = "0123456789abcdef"[((uint64_t)k >> (4 * j)) & 15];
+        key[key_len] = '\0';
+    }
+}
+
+/* Structures under test, behind one interface so that every workload drives them alike */
+
+struct target_t {
+    const char * name;
+    bool string_keys;
+    void * (*create)(void);
+    void (*insert)(void * s, uint32_t k);
+    void (*lookup)(void * s, uint32_t k);
+    void (*delete)(void * s, uint32_t k);
+    void (*destroy)(void * s);
+};
+
+static volatile uint64_t found;  // keeps lookups from being optimized away
+
+static void * avl_create(void) {
+    uint64_t_uint64_t_avl_tree_t * tree = malloc(sizeof(*tree));
+    *tree = create_uint64_t_uint64_t_avl_tree_pooled();
+    return tree;
+}
+static void avl_insert(void * s, uint32_t k) { uint64_t_uint64_t_avl_insert(s, k, k); }
+static void avl_lookup(void * s, uint32_t k) { found += uint64_t_uint64_t_avl_search(s, k) != NULL; }
+static void avl_delete(void * s, uint32_t k) { uint64_t_uint64_t_avl_delete(s, k); }
+static void avl_destroy(void * s) {
+    clear_uint64_t_uint64_t_avl_tree(s);
+    free(s);
+}
+
+static void * dict_create(void) {
+    dict_t * dict = malloc(sizeof(*dict));
+    *dict = create_dict_pooled();
+    return dict;
+}
+static void dict_insert(void * s, uint32_t k) { dict_add(s, KEY(k), k); }
+static void dict_lookup(void * s, uint32_t k) { found += dict_get(*(dict_t *)s, KEY(k)) != NULL; }
+static void dict_remove(void * s, uint32_t k) { dict_delete(s, KEY(k)); }
+static void dict_destroy(void * s) {
+    clear_dict(s);
+    free(s);
+}
+
+static void * hash_create(void) {
+    hash_dict_t * dict = malloc(sizeof(*dict));
+    *dict = create_hash_dict();
+    return dict;
+}
+static void hash_insert(void * s, uint32_t k) { hash_dict_add(s, KEY(k), k); }
+static void hash_lookup(void * s, uint32_t k) { found += hash_dict_get(*(hash_dict_t *)s, KEY(k)) != NULL; }
+static void hash_remove(void * s, uint32_t k) { hash_dict_delete(s, KEY(k)); }
+static void hash_destroy(void * s) {
+    clear_hash_dict(s);
+    free(s);
+}
+
+static const struct target_t targets[] = {
+    {"avl", false, avl_create, avl_insert, avl_lookup, avl_delete, avl_destroy},
+    {"dict", true, dict_create, dict_insert, dict_lookup, dict_remove, dict_destroy},
+    {"hash_dict", true, hash_create, hash_insert, hash_lookup, hash_remove, hash_destroy},
+};
+
+static const unsigned string_key_lens[] = {8, 24, 64};
+
+/* Workloads: the key indices each operation uses, generated before any timing */
+
+enum workload_t { SEQUENTIAL, UNIFORM, ZIPFIAN };
+static const char * workload_names[] = {"sequential", "uniform", "zipfian"};
+
+/** Zipfian ranks in [0, n), rank 0 the most frequent (Gray et al., as used by YCSB) */
+struct zipf_t {
+    unsigned n;
+    double zetan, alpha, eta, half_pow_theta;
+};
+
+static struct zipf_t create_zipf(unsigned n) {
+    struct zipf_t z;
+    z.n = n;
+    z.zetan = 0;
+    for (unsigned i = 1; i <= n; ++i) z.zetan += 1 / pow(i, ZIPF_THETA);
+    double zeta2 = 1 + 1 / pow(2, ZIPF_THETA);
+    z.alpha = 1 / (1 - ZIPF_THETA);
+    z.eta = (1 - pow(2.0 / n, 1 - ZIPF_THETA)) / (1 - zeta2 / z.zetan);
+    z.half_pow_theta = 1 + pow(0.5, ZIPF_THETA);
+    return z;
+}
+
+static unsigned next_zipf(const struct zipf_t * z) {
+    double u = (next_random() >> 11) * 0x1.0p-53, uz = u * z->zetan;
+    if (uz < 1) return 0;
+    if (uz < z->half_pow_theta) return 1;
+    unsigned rank = z->n * pow(z->eta * u - z->eta + 1, z->alpha);
+    return rank < z->n ? rank : z->n - 1;
+}
+
+/**
+ * order[] drives inserts, queries[] lookups, and the first *n_deletes of deletes[] deletes
+ * Sequential walks the keys in order; uniform inserts and deletes a random permutation and
+ * looks up random keys; Zipfian draws every insert and lookup by popularity, the popular keys
+ * scattered over the key space, then deletes each inserted key once, in order of first draw.
+ */
+static void make_workload(enum workload_t workload, unsigned n, uint32_t * order, uint32_t * queries,
+                          uint32_t * deletes, unsigned * n_deletes) {
+    for (unsigned i = 0; i < n; ++i) order[i] = i;
+    *n_deletes = n;
+    if (workload == SEQUENTIAL) {
+        memcpy(queries, order, sizeof(uint32_t) * n);
+        memcpy(deletes, order, sizeof(uint32_t) * n);
+        return;
+    }
+    for (unsigned i = n - 1; i > 0; --i) {
+        unsigned j = next_random() % (i + 1);
+        uint32_t swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    if (workload == UNIFORM) {
+        for (unsigned i = 0; i < n; ++i) queries[i] = next_random() % n;
+        memcpy(deletes, order, sizeof(uint32_t) * n);
+        return;
+    }
+    struct zipf_t zipf = create_zipf(n);
+    for (unsigned i = 0; i < n; ++i) queries[i] = order[next_zipf(&zipf)];
+    for (unsigned i = 0; i < n; ++i) deletes[i] = order[next_zipf(&zipf)];  // the draws to insert
+    memcpy(order, deletes, sizeof(uint32_t) * n);
+    uint8_t * drawn = calloc(n, 1);
+    *n_deletes = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        if (!drawn[order[i]]) deletes[(*n_deletes)++] = order[i];
+        drawn[order[i]] = 1;
+    }
+    free(drawn);
+}
+
+static void run_phase(struct phase_t * phase, void (*op)(void * s, uint32_t k), void * s, const uint32_t * keys,
+                      unsigned n) {
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < n; ++i) {
+        if (i % LATENCY_STRIDE == 0) {
+            uint64_t t = now_ns();
+            op(s, keys[i]);
+            hist_add(&phase->hist, now_ns() - t);
+        } else {
+            op(s, keys[i]);
+        }
+    }
+    phase->elapsed_ns += now_ns() - start;
+    phase->ops += n;
+}
+
+static void bench_target(const struct target_t * target, enum workload_t workload, unsigned n, unsigned key_len) {
+    static struct case_t c;
+    memset(&c, 0, sizeof(c));
+    c.structure = target->name;
+    c.workload = workload_names[workload];
+    c.keys = n;
+    c.key_len = key_len;
+    c.phases[0].op = "insert";
+    c.phases[1].op = "lookup";
+    c.phases[2].op = "delete";
+    uint32_t * order = malloc(sizeof(uint32_t) * n), * queries = malloc(sizeof(uint32_t) * n);
+    uint32_t * deletes = malloc(sizeof(uint32_t) * n);
+    unsigned n_deletes;
+    make_workload(workload, n, order, queries, deletes, &n_deletes);
+    if (target->string_keys) make_keys(n, key_len);
+    for (unsigned round = 0; round == 0 || (uint64_t)round * n < MIN_OPS; ++round) {
+        void * s = target->create();
+        run_phase(c.phases + 0, target->insert, s, order, n);
+        run_phase(c.phases + 1, target->lookup, s, queries, n);
+        run_phase(c.phases + 2, target->delete, s, deletes, n_deletes);
+        target->destroy(s);
+    }
+    print_case(&c);
+    free(order);
+    free(queries);
+    free(deletes);
+    free(key_arena);
+}
+
+/** Appends n elements, then n pushes and pops in random bursts of up to 64, then pops all */
+static void bench_array(unsigned n) {
+    static struct case_t c;
+    memset(&c, 0, sizeof(c));
+    c.structure = "array";
+    c.workload = "stack";
+    c.keys = n;
+    c.key_len = sizeof(int);
+    c.phases[0].op = "append";
+    c.phases[1].op = "churn";
+    c.phases[2].op = "pop";
+    for (unsigned round = 0; round == 0 || (uint64_t)round * n < MIN_OPS; ++round) {
+        array_t(int) arr = create_array(int, 0, 0);
+        uint64_t start = now_ns();
+        for (unsigned i = 0; i < n; ++i) {
+            if (i % LATENCY_STRIDE == 0) {
+                uint64_t t = now_ns();
+                append(int, &arr, i);
+                hist_add(&c.phases[0].hist, now_ns() - t);
+            } else {
+                append(int, &arr, i);
+            }
+        }
+        c.phases[0].elapsed_ns += now_ns() - start;
+        c.phases[0].ops += n;
+
+        uint64_t elapsed = 0;
+        for (unsigned done = 0; done < n;) {
+            unsigned burst = 1 + next_random() % 64;
+            bool grow = next_random() & 1;
+            start = now_ns();
+            for (unsigned i = 0; i < burst && done < n; ++i, ++done) {
+                uint64_t t = done % LATENCY_STRIDE == 0 ? now_ns() : 0;
+                if (grow || arr.length == 0) append(int, &arr, done);
+                else found += pop(int, &arr);
+                if (t != 0) hist_add(&c.phases[1].hist, now_ns() - t);
+            }
+            elapsed += now_ns() - start;
+        }
+        c.phases[1].elapsed_ns += elapsed;
+        c.phases[1].ops += n;
+
+        unsigned length = arr.length;
+        start = now_ns();
+        for (unsigned i = 0; i < length; ++i) {
+            if (i % LATENCY_STRIDE == 0) {
+                uint64_t t = now_ns();
+                found += pop(int, &arr);
+                hist_add(&c.phases[2].hist, now_ns() - t);
+            } else {
+                found += pop(int, &arr);
+            }
+        }
+        c.phases[2].elapsed_ns += now_ns() - start;
+        c.phases[2].ops += length;
+        delete_array(int, &arr);
+    }
+    print_case(&c);
+}
+
+/** Runs one case in a child process, whose peak RSS is then its own */
+#define RUN_CASE(call) do {                      \
+    fflush(stdout);                              \
+    pid_t pid = fork();                          \
+    if (pid == 0) {                              \
+        call;                                    \
+        fflush(stdout);                          \
+        _exit(0);                                \
+    }                                            \
+    int status;                                  \
+    waitpid(pid, &status, 0);                    \
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) { \
+        fprintf(stderr, "case failed: %s\n", #call); \
+    }                                            \
+} while (0)
+
+int main(int argc, char ** argv) {
+    unsigned max_keys = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MAX_KEYS;
+    calibrate_timer();
+    puts("structure,workload,keys,key_len,op,ops,ops_per_sec,p50_ns,p99_ns,p999_ns,peak_rss_kb");
+    for (uint64_t n = 1000; n <= max_keys; n *= 10) {
+        for (unsigned t = 0; t < sizeof(targets) / sizeof(targets[0]); ++t) {
+            for (enum workload_t w = SEQUENTIAL; w <= ZIPFIAN; ++w) {
+                if (!targets[t].string_keys) {
+                    RUN_CASE(bench_target(targets + t, w, n, sizeof(uint64_t)));
+                    continue;
+                }
+                for (unsigned l = 0; l < sizeof(string_key_lens) / sizeof(string_key_lens[0]); ++l) {
+                    RUN_CASE(bench_target(targets + t, w, n, string_key_lens[l]));
+                }
+            }
+        }
+        RUN_CASE(bench_array(n));
+    }
+    return 0;
+}
@@ -0,0 +1,263 @@
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "concurrent_dict.h"
+#include "dict_key.h"
+
+#define _CD_RECLAIM_BATCH 64  // retired nodes that trigger an attempt to advance the epoch
+
+/*
+ * Reader slots are per thread, shared by all concurrent dicts, and given back by a thread-exit
+ * destructor. A thread that finds all CONCURRENT_DICT_MAX_THREADS taken reads under the shard
+ * lock instead, and tries again on its next lookup.
+ */
+static pthread_mutex_t _cd_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _cd_threads_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _cd_thread_key;
+static unsigned _cd_threads;  // slots ever handed out, so no slot at or above it is in use
+static int _cd_free_slots[CONCURRENT_DICT_MAX_THREADS];  // handed out, then given back
+static unsigned _cd_free_count;
+static _Thread_local int _cd_thread = -1;
+
+static void _cd_thread_exit(void * slot) {
+    pthread_mutex_lock(&_cd_threads_lock);
+    _cd_free_slots[_cd_free_count++] = (int)(intptr_t)slot - 1;
+    pthread_mutex_unlock(&_cd_threads_lock);
+}
+
+static void _cd_threads_init(void) {
+    pthread_key_create(&_cd_thread_key, _cd_thread_exit);
+}
+
+/** Slot for the calling thread until it exits, or -1 if none is free */
+static int _cd_claim_slot(void) {
+    pthread_once(&_cd_threads_once, _cd_threads_init);
+    int slot = -1;
+    pthread_mutex_lock(&_cd_threads_lock);
+    if (_cd_free_count > 0) {
+        slot = _cd_free_slots[--_cd_free_count];
+    } else if (_cd_threads < CONCURRENT_DICT_MAX_THREADS) {
+        slot = (int)_cd_threads;
+        __atomic_store_n(&_cd_threads, _cd_threads + 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&_cd_threads_lock);
+    if (slot >= 0) pthread_setspecific(_cd_thread_key, (void *)(intptr_t)(slot + 1));
+    return slot;
+}
+
+/** shards must be a power of two; returns NULL if out of memory */
+concurrent_dict_t * create_concurrent_dict(unsigned shards) {
+    assert(shards > 0 && (shards & (shards - 1)) == 0);
+    concurrent_dict_t * dict = aligned_alloc(64, (sizeof(concurrent_dict_t) + 63) / 64 * 64);
+    if (dict == NULL) return NULL;
+    dict->shards = aligned_alloc(64, sizeof(struct concurrent_dict_shard_t) * shards);
+    if (dict->shards == NULL) {
+        free(dict);
+        return NULL;
+    }
+    dict->shard_count = shards;
+    for (unsigned i = 0; i < shards; ++i) {
+        pthread_mutex_init(&dict->shards[i].lock, NULL);
+        dict->shards[i].seq = 0;
+        dict->shards[i].dict = create_dict();
+        dict->shards[i].retired = NULL;
+        dict->shards[i].retired_length = dict->shards[i].retired_capacity = 0;
+    }
+    dict->epoch = 1;
+    for (unsigned i = 0; i < CONCURRENT_DICT_MAX_THREADS; ++i) dict->slots[i].epoch = 0;
+    return dict;
+}
+
+/** No other thread may use dict any more */
+void destroy_concurrent_dict(concurrent_dict_t * dict) {
+    assert(dict != NULL);
+    for (unsigned i = 0; i < dict->shard_count; ++i) {
+        struct concurrent_dict_shard_t * shard = dict->shards + i;
+        for (unsigned j = 0; j < shard->retired_length; ++j) dict_release_node(&shard->dict, shard->retired[j].node);
+        free(shard->retired);
+        clear_dict(&shard->dict);
+        pthread_mutex_destroy(&dict->shards[i].lock);
+    }
+    free(dict->shards);
+    free(dict);
+}
+
+inline static struct concurrent_dict_shard_t * _cd_shard(concurrent_dict_t * dict, const char * key) {
+    uint64_t hash = 0xcbf29ce484222325ULL;  // FNV-1a
+    for (; *key != '\0'; ++key) hash = (hash ^ (unsigned char)*key) * 0x100000001b3ULL;
+    return dict->shards + ((hash ^ hash >> 32) & (dict->shard_count - 1));
+}
+
+/**
+ * Announces that the calling thread may hold nodes of the current epoch from now on
+ * Returns NULL if the thread has no slot, and must not read without the shard lock.
+ */
+inline static struct concurrent_dict_slot_t * _cd_enter(concurrent_dict_t * dict) {
+    if (_cd_thread < 0 && (_cd_thread = _cd_claim_slot()) < 0) return NULL;
+    struct concurrent_dict_slot_t * slot = dict->slots + _cd_thread;
+    __atomic_store_n(&slot->epoch, __atomic_load_n(&dict->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return slot;
+}
+
+inline static void _cd_leave(struct concurrent_dict_slot_t * slot) {
+    __atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * dict_get() for a tree a writer may be rotating under us
+ * dict.c stores every link with release, and links are loaded here with acquire, so a node is
+ * fully initialized (key bytes included) before _key_cmp() reads it. The walk gives up after
+ * DICT_MAX_HEIGHT steps, since a half-done rotation can briefly form a cycle; the caller's
+ * sequence check then retries.
+ */
+static struct dict_node_t * _cd_search(struct dict_node_t ** root, const struct _dict_key_t * key) {
+    struct dict_node_t * cursor = __atomic_load_n(root, __ATOMIC_ACQUIRE);
+    for (int steps = 0; cursor != NULL && steps < DICT_MAX_HEIGHT; ++steps) {
+        int cmp = _key_cmp(key, cursor);
+        if (cmp == 0) return cursor;
+        cursor = __atomic_load_n(cmp < 0 ? &cursor->left : &cursor->right, __ATOMIC_ACQUIRE);
+    }
+    return NULL;
+}
+
+/** Never blocks; retries while writers keep changing the shard */
+bool concurrent_dict_get(concurrent_dict_t * dict, const char * key, T * value) {
+    assert(dict != NULL);
+    struct concurrent_dict_shard_t * shard = _cd_shard(dict, key);
+    struct _dict_key_t k = _dict_key(key);
+    struct concurrent_dict_slot_t * slot = _cd_enter(dict);
+    bool found;
+    T val = 0;
+    if (slot == NULL) {
+        pthread_mutex_lock(&shard->lock);
+        struct dict_node_t * node = dict_get(shard->dict, key);
+        found = node != NULL;
+        if (found) val = node->val;
+        pthread_mutex_unlock(&shard->lock);
+        if (found && value) *value = val;
+        return found;
+    }
+    for (;;) {
+        unsigned seq = __atomic_load_n(&shard->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        struct dict_node_t * node = _cd_search(&shard->dict.root, &k);
+        found = node != NULL;
+        if (found) val = __atomic_load_n(&node->val, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shard->seq, __ATOMIC_RELAXED) == seq) break;
+    }
+    _cd_leave(slot);
+    if (found && value) *value = val;
+    return found;
+}
+
+static void _cd_write_begin(struct concurrent_dict_shard_t * shard) {
+    pthread_mutex_lock(&shard->lock);
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void _cd_write_end(struct concurrent_dict_shard_t * shard) {
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/** Returns false if dict already contains the same key, whose value won't be updated */
+bool concurrent_dict_add(concurrent_dict_t * dict, const char * key, T value) {
+    assert(dict != NULL);
+    struct concurrent_dict_shard_t * shard = _cd_shard(dict, key);
+    bool inserted;
+    _cd_write_begin(shard);
+    dict_find_or_insert(&shard->dict, key, value, &inserted);
+    _cd_write_end(shard);
+    return inserted;
+}
+
+void concurrent_dict_set(concurrent_dict_t * dict, const char * key, T value) {
+    assert(dict != NULL);
+    struct concurrent_dict_shard_t * shard = _cd_shard(dict, key);
+    bool inserted;
+    _cd_write_begin(shard);
+    T * val = dict_find_or_insert(&shard->dict, key, value, &inserted);
+    // readers load val of a reachable node without the lock
+    if (!inserted) __atomic_store_n(val, value, __ATOMIC_RELAXED);
+    _cd_write_end(shard);
+}
+
+/** Adds delta to the value under key (0 if absent), and returns the result */
+T concurrent_dict_add_to(concurrent_dict_t * dict, const char * key, T delta) {
+    assert(dict != NULL);
+    struct concurrent_dict_shard_t * shard = _cd_shard(dict, key);
+    _cd_write_begin(shard);
+    T * val = dict_find_or_insert(&shard->dict, key, 0, NULL);
+    T result = *val + delta;
+    __atomic_store_n(val, result, __ATOMIC_RELAXED);
+    _cd_write_end(shard);
+    return result;
+}
+
+/**
+ * Moves the epoch on if every reading thread has seen the current one, then frees the shard's
+ * nodes that are old enough. The caller holds the shard lock.
+ */
+static void _cd_reclaim(concurrent_dict_t * dict, struct concurrent_dict_shard_t * shard) {
+    unsigned long epoch = __atomic_load_n(&dict->epoch, __ATOMIC_SEQ_CST);
+    unsigned threads = __atomic_load_n(&_cd_threads, __ATOMIC_RELAXED);
+    bool quiet = true;
+    for (unsigned i = 0; i < threads && quiet; ++i) {
+        unsigned long seen = __atomic_load_n(&dict->slots[i].epoch, __ATOMIC_SEQ_CST);
+        quiet = seen == 0 || seen == epoch;
+    }
+    // writers of other shards may race us here; either way the epoch moves on by one
+    if (quiet && __atomic_compare_exchange_n(&dict->epoch, &epoch, epoch + 1, false,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        ++epoch;
+    }
+    // readers now announce at least epoch - 1, and nodes retired before that are unreachable
+    unsigned kept = 0;
+    for (unsigned i = 0; i < shard->retired_length; ++i) {
+        if (shard->retired[i].epoch + 2 <= epoch) {
+            dict_release_node(&shard->dict, shard->retired[i].node);
+        } else {
+            shard->retired[kept++] = shard->retired[i];
+        }
+    }
+    shard->retired_length = kept;
+}
+
+/** Returns false if key is absent */
+bool concurrent_dict_delete(concurrent_dict_t * dict, const char * key) {
+    assert(dict != NULL);
+    struct concurrent_dict_shard_t * shard = _cd_shard(dict, key);
+    _cd_write_begin(shard);
+    struct dict_node_t * node = dict_detach(&shard->dict, key);
+    // readers may go on once the tree is whole again; retiring only needs the lock
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELEASE);
+    if (node != NULL) {
+        if (shard->retired_length == shard->retired_capacity) {
+            shard->retired_capacity = shard->retired_capacity ? shard->retired_capacity * 2 : _CD_RECLAIM_BATCH;
+            shard->retired = realloc(shard->retired, sizeof(struct concurrent_dict_retired_t) * shard->retired_capacity);
+            assert(shard->retired != NULL);
+        }
+        shard->retired[shard->retired_length].node = node;
+        shard->retired[shard->retired_length].epoch = __atomic_load_n(&dict->epoch, __ATOMIC_SEQ_CST);
+        if (++shard->retired_length % _CD_RECLAIM_BATCH == 0) _cd_reclaim(dict, shard);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return node != NULL;
+}
+
+/** Exact only while no writer is running */
+unsigned concurrent_dict_size(concurrent_dict_t * dict) {
+    assert(dict != NULL);
+    unsigned size = 0;
+    for (unsigned i = 0; i < dict->shard_count; ++i) {
+        size += __atomic_load_n(&dict->shards[i].dict.size, __ATOMIC_RELAXED);
+    }
+    return size;
+}
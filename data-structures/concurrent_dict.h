@@ -0,0 +1,58 @@
+#ifndef CONCURRENT_DICT_H
+#define CONCURRENT_DICT_H
+
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include "dict.h"
+
+#ifdef DICT_USE_HASH
+#error "concurrent dicts shard AVL dicts: build them without DICT_USE_HASH"
+#endif
+
+#define CONCURRENT_DICT_MAX_THREADS 256  // threads reading lock-free at once; others take the lock
+
+struct concurrent_dict_retired_t {
+    struct dict_node_t * node;
+    unsigned long epoch;
+};
+
+/**
+ * One independent AVL dict; writers take the lock, readers only watch seq
+ * Nodes deleted from the shard wait in retired, under the same lock, until no reader can hold them.
+ */
+struct concurrent_dict_shard_t {
+    alignas(64) pthread_mutex_t lock;
+    unsigned seq;  // odd while a writer is changing the tree
+    dict_t dict;
+    struct concurrent_dict_retired_t * retired;
+    unsigned retired_length, retired_capacity;
+};
+
+/** Epoch a thread announced before reading, or 0 when it is not reading */
+struct concurrent_dict_slot_t {
+    alignas(64) unsigned long epoch;
+};
+
+/**
+ * Dict sharded by key hash, for many threads at once
+ * Lookups take no lock: they validate against the shard's sequence counter and retry if a
+ * writer got in the way. Deleted nodes are reclaimed by epochs once no reader can hold them.
+ */
+typedef struct concurrent_dict_t {
+    struct concurrent_dict_shard_t * shards;
+    unsigned shard_count;  // power of two
+    unsigned long epoch;
+    struct concurrent_dict_slot_t slots[CONCURRENT_DICT_MAX_THREADS];
+} concurrent_dict_t;
+
+concurrent_dict_t * create_concurrent_dict(unsigned shards);
+void destroy_concurrent_dict(concurrent_dict_t * dict);
+bool concurrent_dict_add(concurrent_dict_t * dict, const char * key, T value);
+bool concurrent_dict_get(concurrent_dict_t * dict, const char * key, T * value);
+void concurrent_dict_set(concurrent_dict_t * dict, const char * key, T value);
+T concurrent_dict_add_to(concurrent_dict_t * dict, const char * key, T delta);
+bool concurrent_dict_delete(concurrent_dict_t * dict, const char * key);
+unsigned concurrent_dict_size(concurrent_dict_t * dict);
+
+#endif
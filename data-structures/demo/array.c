@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "../array.h"
+
+USE_ARRAY(int);
+USE_ARRAY_INTEGER_ALGORITHMS(int)
+USE_ARRAY_SUM(int, long long)
+
+static bool is_even(int x) {
+    return x % 2 == 0;
+}
+
+int main() {
+    array_t(int) arr = create_array(int, 3, 3);
+    for (size_t i = 0; i < arr.length; ++i) {
+        at(arr, i) = i * 10;
+        printf("set arr[%zu] = %d\n", i, at(arr, i));
+    }
+    append(int, &arr, 30);
+    append(int, &arr, 40);
+    append(int, &arr, 50);
+    printf("arr.length = %zu, arr.capacity = %zu\n", arr.length, arr.capacity);
+    while (arr.length > 0) {
+        printf("pop %d\n", pop(int, &arr));
+    }
+    printf("arr.length = %zu, arr.capacity = %zu\n", arr.length, arr.capacity);
+    for (int i = 0; i < 10; ++i) {
+        append(int, &arr, -i);
+        for (size_t i = 0; i < arr.length; ++i) {
+            printf(" %d", at(arr, i));
+        }
+        printf(" | length=%zu, capacity=%zu, %s\n", arr.length, arr.capacity, arr.addr ? "heap" : "inline");
+    }
+    for (size_t i = 0; i < arr.length; ++i) {
+        printf("arr[%zu] = %d\n", i, at(arr, i));
+    }
+    while (arr.length > 5) {
+        printf("pop %d\n", pop(int, &arr));
+    }
+    printf("arr.length = %zu, arr.capacity = %zu\n", arr.length, arr.capacity);
+
+    int more[] = {100, 200, 300, 400, 500, 600, 700, 800, 900};
+    append_n(int, &arr, more, 9);
+    insert_at(int, &arr, 0, -100);
+    erase_range(int, &arr, 3, 6);
+    extend(int, &arr, &arr);
+    printf("after append_n/insert_at/erase_range/extend:");
+    for (size_t i = 0; i < arr.length; ++i) {
+        printf(" %d", at(arr, i));
+    }
+    printf(" | length=%zu, capacity=%zu\n", arr.length, arr.capacity);
+    delete_array(int, &arr);
+
+    struct thread_pool_t * threads = create_thread_pool(3);
+    for (int i = 0; i < 1000000; ++i) append(int, &arr, (int)((i * 2654435761u) % 2000003) - 1000000);
+    parallel_sort(int, &arr, threads);
+    printf("sorted %zu ints: min=%d max=%d sum=%lld evens=%zu\n", arr.length, min_int(&arr), max_int(&arr),
+           parallel_sum_int(&arr, threads), parallel_count_if_int(&arr, is_even, threads));
+    size_t index = lower_bound(int, &arr, 0);
+    printf("first non-negative: arr[%zu] = %d\n", index, at(arr, index));
+    destroy_thread_pool(threads);
+    delete_array(int, &arr);
+
+    arr = open_array(int, "array_demo.bin");
+    assert(arr.fd >= 0);
+    for (int i = 0; i < 5000; ++i) append(int, &arr, i * i);
+    delete_array(int, &arr);  // syncs and unmaps
+    arr = open_array(int, "array_demo.bin");
+    printf("reopened file-backed array: length=%zu, capacity=%zu, arr[4999] = %d\n", arr.length, arr.capacity,
+           at(arr, 4999));
+    delete_array(int, &arr);
+    unlink("array_demo.bin");
+#ifdef DS_STATS
+    struct array_stats_t stats = array_stats();
+    printf("stats: %llu appends, %llu pops, %llu reallocs, %llu bytes\n", (unsigned long long)stats.appends,
+           (unsigned long long)stats.pops, (unsigned long long)stats.reallocs,
+           (unsigned long long)stats.bytes_allocated);
+#endif
+    return 0;
+}
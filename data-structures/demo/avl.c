@@ -0,0 +1,109 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "../avl_int.h"
+
+int main() {
+    srand(1);
+    struct avl_tree_t tree = create_avl_tree();
+
+    avl_insert(&tree, 3, 3);
+    avl_insert(&tree, 9, 9);
+    avl_insert(&tree, 4, 4);
+    avl_insert(&tree, 0, 0);
+    avl_insert(&tree, 5, 5);
+    avl_insert(&tree, 2, 2);
+    avl_insert(&tree, 7, 7);
+    avl_insert(&tree, 8, 8);
+    avl_insert(&tree, 1, 1);
+    avl_insert(&tree, 6, 6);
+    avl_print(tree.root, 0, 0); putchar('\n');
+
+    // check insert duplicate
+    // if (avl_insert(&tree, 7, 8) == NULL)
+    //     puts("Failed to insert as expected\n");
+
+    // printf("size=%d\n", tree.size);
+    // avl_delete(&tree, 11);
+    // printf("size=%d\n", tree.size);
+    // avl_print(tree.root, 0); putchar('\n');
+    // clear_avl_tree(&tree);
+
+    avl_delete(&tree, 7);
+    puts("deleted 7:");
+    avl_print(tree.root, 0, 0); putchar('\n');
+
+    avl_delete(&tree, 8);
+    puts("deleted 8:");
+    avl_print(tree.root, 0, 0); putchar('\n');
+
+    // avl_delete(&tree, 3);
+    // puts("deleted 3:");
+    // avl_print(tree.root, 0, 0); putchar('\n');
+
+    // avl_delete(&tree, 5);
+    // puts("deleted 5:");
+    // avl_print(tree.root, 0, 0); putchar('\n');
+
+    // avl_print(tree.root, 0); putchar('\n');
+    clear_avl_tree(&tree);
+
+    // avl_insert(&tree, 3, 3);
+    // avl_insert(&tree, 9, 9);
+    // avl_insert(&tree, 4, 4);
+    // avl_insert(&tree, 0, 0);
+
+    // avl_print(tree.root, 0); putchar('\n');
+    // clear_avl_tree(&tree);
+
+    tree = create_avl_tree();
+    for (int i = 0; i < 100; i += 3) avl_insert(&tree, i, -i);
+    struct frozen_avl_tree_t frozen = avl_freeze(&tree);
+    for (int i = 0; i < 100; ++i) {
+        assert(frozen_avl_search(&frozen, i) == avl_search(&tree, i));
+    }
+    printf("frozen search 42: value=%d\n\n", frozen_avl_search(&frozen, 42)->val);
+    clear_frozen_avl_tree(&frozen);
+    clear_avl_tree(&tree);
+
+    int sorted_keys[] = {1, 2, 3, 5, 8, 13, 21}, batch[] = {4, 13, 6, 1, 7, 6};
+    avl_build_from_sorted(&tree, sorted_keys, sorted_keys, 7);
+    printf("inserted %u of 6 batch keys:\n", avl_batch_insert(&tree, batch, batch, 6));
+    avl_print(tree.root, 0, 0); putchar('\n');
+    clear_avl_tree(&tree);
+
+    for (int i = 0; i < 20; ++i) avl_insert(&tree, i * 5, i);
+    struct avl_iter_t iter;
+    printf("keys in [12, 42):");
+    for (struct avl_node_t * node = avl_range(&tree, 12, 42, &iter); node; node = avl_iter_next(&iter)) {
+        printf(" %d", node->key);
+    }
+    printf("\nkeys below 23, descending:");
+    avl_lower_bound(&tree, 23, &iter);
+    for (struct avl_node_t * node = avl_iter_prev(&iter); node; node = avl_iter_prev(&iter)) {
+        printf(" %d", node->key);
+    }
+#ifdef AVL_ORDER_STATISTICS
+    printf("\nrank(23) = %u, select(7) = %d", avl_rank(&tree, 23), avl_select(&tree, 7, &iter)->key);
+#endif
+    puts("\n");
+    clear_avl_tree(&tree);
+
+    struct avl_tree_t pooled = create_avl_tree_pooled();
+    for (int i = 0; i < 10; ++i) avl_insert(&pooled, i, i * i);
+    avl_delete(&pooled, 4);
+    avl_insert(&pooled, 40, 1600);  // reuses the node freed above
+    puts("pooled tree:");
+    avl_print(pooled.root, 0, 0); putchar('\n');
+    clear_avl_tree(&pooled);
+
+#ifdef DS_STATS
+    struct avl_stats_t stats = avl_stats();
+    printf("stats: %llu lookups, %.2f compares each, max depth %llu, %llu rotations, %llu maintains, "
+           "%llu nodes, %llu bytes\n", (unsigned long long)stats.lookups,
+           stats.lookups ? (double)stats.compares / stats.lookups : 0, (unsigned long long)stats.max_depth,
+           (unsigned long long)stats.rotations, (unsigned long long)stats.maintains,
+           (unsigned long long)stats.allocations, (unsigned long long)stats.bytes_allocated);
+#endif
+    return 0;
+}
@@ -1,205 +1,990 @@
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#undef DICT_USE_HASH  // this file is the AVL implementation
+// concurrent_dict.c readers walk these trees while a writer links nodes: publish every link
+#define _AVL_LINK(link, node) __atomic_store_n(&(link), (node), __ATOMIC_RELEASE)
+#include "avl.h"
 #include "dict.h"
+#include "dict_key.h"
+#include "thread_pool.h"
 
 struct dict_t create_dict(void) {
     struct dict_t tree;
     tree.root = NULL;
     tree.size = 0;
+    tree.pool.obj_size = 0;
     return tree;
 }
 
-inline static struct avl_node_t * _create_avl_node(const char * key, T value) {
-    struct avl_node_t * new_node = malloc(sizeof(struct avl_node_t));
+/** Nodes and key bytes of the returned dict are carved from per-dict slabs */
+struct dict_t create_dict_pooled(void) {
+    struct dict_t tree = create_dict();
+    tree.pool = create_pool(sizeof(struct dict_node_t));
+    return tree;
+}
+
+#define _DICT_POOL(tree) ((tree)->pool.obj_size > 0 ? &(tree)->pool : NULL)
+
+#ifdef DS_STATS
+static struct avl_stats_t _dict_stats;
+#endif
+
+USE_AVL_BALANCE(avl, struct dict_node_t, _dict_stats)
+
+inline static struct dict_node_t * _create_avl_node(const struct _dict_key_t * key, T value, struct pool_t * pool) {
+    struct dict_node_t * new_node = pool ? pool_alloc(pool) : malloc(sizeof(struct dict_node_t));
     assert(new_node != NULL);
-    new_node->key = strdup(key);
+    _STATS_ADD(_dict_stats.allocations, 1);
+    _STATS_ADD(_dict_stats.bytes_allocated, sizeof(struct dict_node_t));
+    if (key->len < DICT_INLINE_KEY) {
+        memcpy(new_node->inline_key, key->str, key->len + 1);
+        new_node->key = new_node->inline_key;
+    } else {
+        new_node->key = pool ? pool_strdup(pool, key->str) : strdup(key->str);
+        assert(new_node->key != NULL);
+        _STATS_ADD(_dict_stats.bytes_allocated, key->len + 1);
+    }
+    new_node->prefix = key->prefix;
+    new_node->len = key->len;
     new_node->val = value;
     new_node->left = new_node->right = NULL;
     new_node->height = 0;
+#ifdef AVL_ORDER_STATISTICS
+    new_node->count = 1;
+#endif
     return new_node;
 }
 
-inline static void _destroy_avl_node(struct avl_node_t * node) {
-    free(node->key);
-    free(node);
+inline static void _destroy_avl_node(struct dict_node_t * node, struct pool_t * pool) {
+    if (pool) {
+        if (node->key != node->inline_key) pool_strfree(pool, node->key);
+        pool_free(pool, node);
+    } else {
+        if (node->key != node->inline_key) free(node->key);
+        free(node);
+    }
 }
 
-void _destroy_dict(struct avl_node_t * tree) {
+void _destroy_dict(struct dict_node_t * tree) {
     assert(tree != NULL);
     if (tree->left != NULL) _destroy_dict(tree->left);
     if (tree->right != NULL) _destroy_dict(tree->right);
-    _destroy_avl_node(tree);
+    _destroy_avl_node(tree, NULL);
 }
 
+/** O(#slabs) for pooled dicts, O(n) otherwise */
 void clear_dict(dict_t * tree) {
-    _destroy_dict(tree->root);
+    assert(tree != NULL);
+    if (tree->pool.obj_size > 0) {
+        pool_clear(&tree->pool);
+    } else if (tree->root != NULL) {
+        _destroy_dict(tree->root);
+    }
     tree->root = NULL;
     tree->size = 0;
 }
 
-#define _AVL_HEIGHT(tree) ((tree) ? (tree)->height : -1)
-
-inline static void _avl_update_height(struct avl_node_t * tree) { // tree != NULL
-    int left_height = _AVL_HEIGHT(tree->left);
-    int right_height = _AVL_HEIGHT(tree->right);
-    tree->height = (left_height > right_height ? left_height : right_height) + 1;
-}
-
-inline static struct avl_node_t * _avl_left_rotate(struct avl_node_t * tree) {
-    struct avl_node_t * rotated = tree->right;
-    tree->right = rotated->left;
-    _avl_update_height(tree);
-    rotated->left = tree;
-    _avl_update_height(rotated);
-    return rotated;
-}
-
-inline static struct avl_node_t * _avl_right_rotate(struct avl_node_t * tree) {
-    struct avl_node_t * rotated = tree->left;
-    tree->left = rotated->right;
-    _avl_update_height(tree);
-    rotated->right = tree;
-    _avl_update_height(rotated);
-    return rotated;
-}
-
-static struct avl_node_t * _avl_maintain(struct avl_node_t * tree) {
-    _avl_update_height(tree);
-    struct avl_node_t * left = tree->left, * right = tree->right;
-    if (_AVL_HEIGHT(left) > _AVL_HEIGHT(right) + 1) {
-        if (_AVL_HEIGHT(left->left) >= _AVL_HEIGHT(left->right)) {
-            return _avl_right_rotate(tree);
-        } else {
-            tree->left = _avl_left_rotate(tree->left);
-            return _avl_right_rotate(tree);
-        }
-    } else if (_AVL_HEIGHT(left) + 1 < _AVL_HEIGHT(right)) {
-        if (_AVL_HEIGHT(right->right) >= _AVL_HEIGHT(right->left)) {
-            return _avl_left_rotate(tree);
-        } else {
-            tree->right = _avl_right_rotate(tree->right);
-            return _avl_left_rotate(tree);
-        }
-    } else {
-        return tree;
+/**
+ * Descends once: either finds key or links a new node where the search fell off the tree
+ * *found receives the node holding key. Only the path of a real insertion is rebalanced.
+ */
+static struct dict_node_t * _avl_insert(struct dict_node_t * tree, const struct _dict_key_t * key, T value,
+                                       struct dict_node_t ** found, unsigned * size, struct pool_t * pool) {
+    if (tree == NULL) {
+        ++(*size);
+        return *found = _create_avl_node(key, value, pool);
     }
-}
-
-static struct avl_node_t * _avl_insert(struct avl_node_t * tree, struct avl_node_t * node, unsigned * size) {
-    int cmp = strcmp(node->key, tree->key);
+    unsigned old_size = *size;
+    int cmp = _key_cmp(key, tree);
     if (cmp < 0) {
-        if (tree->left != NULL) {
-            tree->left = _avl_insert(tree->left, node, size);
-        } else {
-            tree->left = node;
-            ++(*size);
-        }
+        _AVL_LINK(tree->left, _avl_insert(tree->left, key, value, found, size, pool));
     } else if (cmp > 0) {
-        if (tree->right != NULL) {
-            tree->right = _avl_insert(tree->right, node, size);
-        } else {
-            tree->right = node;
-            ++(*size);
-        }
+        _AVL_LINK(tree->right, _avl_insert(tree->right, key, value, found, size, pool));
     } else {
-        _destroy_avl_node(node);
+        *found = tree;
     }
-    return tree = _avl_maintain(tree);
-}
-
-static struct avl_node_t * _avl_min(struct avl_node_t * tree) {
-    assert(tree != NULL);
-    while (tree->left != NULL)
-        tree = tree->left;
-    return tree;
-}
-
-/** Note that min node is not deleted using free() intentionally */
-static struct avl_node_t * _avl_exclude_min(struct avl_node_t * tree) {
-    assert(tree != NULL);
-    if (tree->left == NULL) { // current node excluded but not deleted
-        tree = tree->right;
-    } else {
-        // min in left subtree
-        tree->left = _avl_exclude_min(tree->left);
-        tree = _avl_maintain(tree);
-    }
-    return tree;
+    return *size == old_size ? tree : _avl_maintain(tree);
 }
 
 // Reference: Algorithms (4th ed.) by R. Sedgewick & K. Wayne
-static struct avl_node_t * _avl_delete(struct avl_node_t * tree, const char * key) {
-    // if (tree == NULL) return NULL;  // nothing deleted
-    assert(tree != NULL);  // inexistent key causes an assertion error
-    int cmp = strcmp(key, tree->key);
+/** Unlinks the node holding key into *removed, which stays NULL if there is none */
+static struct dict_node_t * _avl_delete(struct dict_node_t * tree, const struct _dict_key_t * key,
+                                       struct dict_node_t ** removed) {
+    if (tree == NULL) return NULL;  // nothing deleted
+    int cmp = _key_cmp(key, tree);
     if (cmp < 0) {
-        tree->left = _avl_delete(tree->left, key);
-        tree = _avl_maintain(tree);
+        _AVL_LINK(tree->left, _avl_delete(tree->left, key, removed));
+        if (*removed) tree = _avl_maintain(tree);
     } else if (cmp > 0) {
-        tree->right = _avl_delete(tree->right, key);
-        tree = _avl_maintain(tree);
+        _AVL_LINK(tree->right, _avl_delete(tree->right, key, removed));
+        if (*removed) tree = _avl_maintain(tree);
     } else { // delete current node
-        struct avl_node_t * current = tree;
+        struct dict_node_t * current = tree;
         if (current->right == NULL) {
             tree = current->left;
         } else if (current->left == NULL) {
             tree = current->right;
         } else { // we know that right subtree is not empty
             tree = _avl_min(current->right);  // find successor
-            tree->right = _avl_exclude_min(current->right); // successor deleted
-            tree->left = current->left;
+            _AVL_LINK(tree->right, _avl_exclude_min(current->right)); // successor deleted
+            _AVL_LINK(tree->left, current->left);
             tree = _avl_maintain(tree);
         }
-        _destroy_avl_node(current);
+        *removed = current;
     }
     return tree;
 }
 
+/**
+ * Returns the address of the value stored under key, inserting value first if key is absent
+ * *inserted (if not NULL) tells whether a node was created; nothing is allocated otherwise
+ */
+T * dict_find_or_insert(dict_t * tree, const char * key, T value, bool * inserted) {
+    assert(tree != NULL);
+    struct dict_node_t * found = NULL;
+    unsigned old_size = tree->size;
+    struct _dict_key_t k = _dict_key(key);
+    _AVL_LINK(tree->root, _avl_insert(tree->root, &k, value, &found, &(tree->size), _DICT_POOL(tree)));
+    if (inserted) *inserted = tree->size != old_size;
+    return &found->val;
+}
+
+/** Sets the value under key in a single descent, and returns the address of the stored value */
+T * dict_upsert(dict_t * tree, const char * key, T value) {
+    bool inserted;
+    T * val = dict_find_or_insert(tree, key, value, &inserted);
+    if (!inserted) *val = value;
+    return val;
+}
+
 /**
  * Returns the address of inserted node, or NULL if tree already contains the same key
  * When duplicate, values won't be updated
  */
-struct avl_node_t * dict_add(dict_t * tree, const char * key, T value) {
+struct dict_node_t * dict_add(dict_t * tree, const char * key, T value) {
     assert(tree != NULL);
-    // create a new node
-    struct avl_node_t * new_node = _create_avl_node(key, value);
-    // insert
-    if (tree->root == NULL) {
-        tree->size = 1;
-        tree->root = new_node;
-    } else {
-        unsigned old_size = tree->size;
-        tree->root = _avl_insert(tree->root, new_node, &(tree->size));
-        if (tree->size == old_size) new_node = NULL;
-    }
-    return new_node;
+    struct dict_node_t * found = NULL;
+    unsigned old_size = tree->size;
+    struct _dict_key_t k = _dict_key(key);
+    _AVL_LINK(tree->root, _avl_insert(tree->root, &k, value, &found, &(tree->size), _DICT_POOL(tree)));
+    return tree->size != old_size ? found : NULL;
 }
 
 /** Returns the address of a node with given key, or NULL if not found */
-struct avl_node_t * dict_get(dict_t tree, const char * key) {
-    struct avl_node_t * cursor = tree.root;
+struct dict_node_t * dict_get(dict_t tree, const char * key) {
+    struct dict_node_t * cursor = tree.root;
+    struct _dict_key_t k = _dict_key(key);
+    unsigned depth = 0;
     while (cursor != NULL) {
-        int cmp = strcmp(key, cursor->key);
+        int cmp = _key_cmp(&k, cursor);
+        ++depth;
         if (cmp < 0) cursor = cursor->left;
         else if (cmp > 0) cursor = cursor->right;
         else break;
     }
+    _STATS_LOOKUP(_dict_stats, depth);
     return cursor;
 }
 
-void dict_set(dict_t * tree, const char * key, T value) {
-    struct avl_node_t * cursor = dict_get(*tree, key);
-    if (cursor) {
-        cursor->val = value;
-    } else {
-        dict_add(tree, key, value);
+/** One lookup of a batch: its key and where its descent stands */
+struct _dict_lane_t {
+    struct _dict_key_t key;
+    struct dict_node_t * cursor;
+    unsigned index;
+    unsigned depth;  // compares so far, for _STATS_LOOKUP
+};
+
+/**
+ * results[i] = dict_get(dict, keys[i]) for every i < n
+ * Up to DICT_BATCH_LANES descents advance one level per round, and each prefetches the child
+ * it moves to, so the cache misses of different lookups overlap instead of queueing up.
+ */
+void dict_get_many(dict_t tree, const char * const * keys, unsigned n, struct dict_node_t ** results) {
+    assert(n == 0 || (keys != NULL && results != NULL));
+    struct _dict_lane_t lanes[DICT_BATCH_LANES];
+    unsigned active = 0, next = 0;
+    while (next < n && active < DICT_BATCH_LANES) {
+        lanes[active].key = _dict_key(keys[next]);
+        lanes[active].cursor = tree.root;
+        lanes[active].depth = 0;
+        lanes[active++].index = next++;
+    }
+    while (active > 0) {
+        for (unsigned i = 0; i < active; ) {
+            struct _dict_lane_t * lane = lanes + i;
+            struct dict_node_t * cursor = lane->cursor;
+            int cmp = cursor == NULL ? 0 : _key_cmp(&lane->key, cursor);
+            lane->depth += cursor != NULL;
+            if (cmp != 0) {
+                lane->cursor = cmp < 0 ? cursor->left : cursor->right;
+                __builtin_prefetch(lane->cursor);
+                ++i;
+                continue;
+            }
+            results[lane->index] = cursor;
+            _STATS_LOOKUP(_dict_stats, lane->depth);
+            if (next < n) {  // the lane starts over with the next key
+                lane->key = _dict_key(keys[next]);
+                lane->cursor = tree.root;
+                lane->depth = 0;
+                lane->index = next++;
+                ++i;
+            } else {
+                *lane = lanes[--active];
+            }
+        }
     }
 }
 
+#ifdef DS_STATS
+/** Counters of all dicts, see stats.h */
+struct avl_stats_t dict_stats(void) {
+    return _avl_stats_read(&_dict_stats);
+}
+#endif
+
+void dict_set(dict_t * tree, const char * key, T value) {
+    dict_upsert(tree, key, value);
+}
+
 /** inexistent key will cause an error */
 void dict_delete(dict_t * tree, const char * key) {
+    struct dict_node_t * removed = dict_detach(tree, key);
+    assert(removed != NULL);  // inexistent key causes an assertion error
+    _destroy_avl_node(removed, _DICT_POOL(tree));
+}
+
+/**
+ * Unlinks the node holding key without releasing it, or returns NULL if there is none
+ * The node keeps its key and value until it is handed to dict_release_node(), which lets
+ * concurrent readers that may still hold it finish first.
+ */
+struct dict_node_t * dict_detach(dict_t * tree, const char * key) {
+    assert(tree != NULL);
+    struct _dict_key_t k = _dict_key(key);
+    struct dict_node_t * removed = NULL;
+    _AVL_LINK(tree->root, _avl_delete(tree->root, &k, &removed));
+    if (removed) tree->size--;
+    return removed;
+}
+
+void dict_release_node(dict_t * tree, struct dict_node_t * node) {
+    assert(tree != NULL && node != NULL);
+    _destroy_avl_node(node, _DICT_POOL(tree));
+}
+
+#define _DICT_CACHE_LINE 64
+
+/** Lays the in-order sequence out so that slot k has children 2k and 2k+1 */
+static void _dict_eytzinger(struct frozen_dict_t * frozen, unsigned * next, unsigned k) {
+    if (k > frozen->size) return;
+    _dict_eytzinger(frozen, next, 2 * k);
+    frozen->prefixes[k] = frozen->nodes[*next]->prefix;
+    frozen->ranks[k] = (*next)++;
+    _dict_eytzinger(frozen, next, 2 * k + 1);
+}
+
+/** O(n) */
+struct frozen_dict_t dict_freeze(const dict_t * tree) {
+    assert(tree != NULL);
+    struct frozen_dict_t frozen;
+    frozen.size = tree->size;
+    size_t bytes = sizeof(uint64_t) * (tree->size + 1);
+    bytes = (bytes + _DICT_CACHE_LINE - 1) / _DICT_CACHE_LINE * _DICT_CACHE_LINE;
+    frozen.prefixes = aligned_alloc(_DICT_CACHE_LINE, bytes);
+    frozen.ranks = malloc(sizeof(unsigned) * (tree->size + 1));
+    frozen.nodes = malloc(sizeof(struct dict_node_t *) * (tree->size + 1));
+    assert(frozen.prefixes != NULL && frozen.ranks != NULL && frozen.nodes != NULL);
+    unsigned count = 0;
+    _avl_collect(tree->root, frozen.nodes, &count);
+    assert(count == tree->size);
+    count = 0;
+    _dict_eytzinger(&frozen, &count, 1);
+    return frozen;
+}
+
+/** In-order position of the first node whose prefix is not less than prefix */
+inline static unsigned _frozen_lower_bound(const struct frozen_dict_t * frozen, uint64_t prefix) {
+    unsigned k = 1;
+    while (k <= frozen->size) {
+        // the 8 slots 3 levels below k share one cache line
+        __builtin_prefetch(frozen->prefixes + 8 * k);
+        k = 2 * k + (frozen->prefixes[k] < prefix);
+    }
+    k >>= __builtin_ffs(~k);
+    return k != 0 ? frozen->ranks[k] : frozen->size;
+}
+
+/** Returns the address of a node with given key, or NULL if not found */
+struct dict_node_t * frozen_dict_get(const struct frozen_dict_t * frozen, const char * key) {
+    assert(frozen != NULL);
+    struct _dict_key_t k = _dict_key(key);
+    unsigned lo = _frozen_lower_bound(frozen, k.prefix);
+    if (lo == frozen->size || frozen->nodes[lo]->prefix != k.prefix) return NULL;
+    if (k.len < 8) return frozen->nodes[lo];  // a short key is all prefix
+    // binary search the keys sharing these 8 bytes
+    unsigned hi = k.prefix == UINT64_MAX ? frozen->size : _frozen_lower_bound(frozen, k.prefix + 1);
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        int cmp = _key_cmp(&k, frozen->nodes[mid]);
+        if (cmp < 0) hi = mid;
+        else if (cmp > 0) lo = mid + 1;
+        else return frozen->nodes[mid];
+    }
+    return NULL;
+}
+
+void clear_frozen_dict(struct frozen_dict_t * frozen) {
+    assert(frozen != NULL);
+    free(frozen->prefixes);
+    free(frozen->ranks);
+    free(frozen->nodes);
+    frozen->prefixes = NULL;
+    frozen->ranks = NULL;
+    frozen->nodes = NULL;
+    frozen->size = 0;
+}
+
+/** First 64 bytes of a dict image; the entry table and then the key arena follow */
+struct _dict_image_header_t {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t entry_size;  // sizeof(struct dict_image_entry_t), which depends on T
+    uint64_t size;
+    uint64_t arena_bytes;
+    uint64_t checksum;  // of everything after the header
+    char padding[24];
+};
+
+#define _DICT_IMAGE_MAGIC 0x0047414d49544344ULL  // "DCTIMAG" read as little-endian
+#define _DICT_IMAGE_VERSION 1
+
+/** A word-at-a-time hash of bytes, which are assumed 8-byte aligned */
+static uint64_t _dict_image_checksum(const char * bytes, size_t n) {
+    uint64_t hash = n * 0x9e3779b97f4a7c15ULL, word;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    word = 0;
+    memcpy(&word, bytes + i, n - i);
+    hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+    return hash ^ (hash >> 32);
+}
+
+static void _dict_image_fill(struct dict_node_t * tree, struct dict_image_entry_t * entries, char * arena,
+                             unsigned * count, uint64_t * offset) {
+    if (tree == NULL) return;
+    _dict_image_fill(tree->left, entries, arena, count, offset);
+    struct dict_image_entry_t * entry = entries + (*count)++;
+    entry->prefix = tree->prefix;
+    entry->offset = *offset;
+    entry->len = tree->len;
+    entry->val = tree->val;
+    memcpy(arena + *offset, tree->key, tree->len + 1);
+    *offset += tree->len + 1;
+    _dict_image_fill(tree->right, entries, arena, count, offset);
+}
+
+static uint64_t _dict_arena_bytes(const struct dict_node_t * tree) {
+    if (tree == NULL) return 0;
+    return tree->len + 1 + _dict_arena_bytes(tree->left) + _dict_arena_bytes(tree->right);
+}
+
+/**
+ * Writes dict to path as a versioned, checksummed image, in O(n)
+ * The image goes to a temporary file first and replaces path only once it is complete.
+ */
+bool dict_save(const dict_t * tree, const char * path) {
+    assert(tree != NULL && path != NULL);
+    size_t path_len = strlen(path);
+    char * tmp_path = malloc(path_len + 5);
+    assert(tmp_path != NULL);
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+    uint64_t arena_bytes = _dict_arena_bytes(tree->root);
+    size_t table_bytes = sizeof(struct dict_image_entry_t) * tree->size;
+    size_t bytes = sizeof(struct _dict_image_header_t) + table_bytes + arena_bytes;
+    bool ok = false;
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0 && ftruncate(fd, bytes) == 0) {
+        struct _dict_image_header_t * header = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (header != MAP_FAILED) {
+            char * body = (char *)(header + 1);
+            unsigned count = 0;
+            uint64_t offset = 0;
+            _dict_image_fill(tree->root, (struct dict_image_entry_t *)body, body + table_bytes, &count, &offset);
+            assert(count == tree->size && offset == arena_bytes);
+            header->magic = _DICT_IMAGE_MAGIC;
+            header->version = _DICT_IMAGE_VERSION;
+            header->entry_size = sizeof(struct dict_image_entry_t);
+            header->size = tree->size;
+            header->arena_bytes = arena_bytes;
+            header->checksum = _dict_image_checksum(body, table_bytes + arena_bytes);
+            ok = msync(header, bytes, MS_SYNC) == 0;
+            munmap(header, bytes);
+        }
+    }
+    if (fd >= 0) close(fd);
+    ok = ok && rename(tmp_path, path) == 0;
+    if (!ok) unlink(tmp_path);
+    free(tmp_path);
+    return ok;
+}
+
+/**
+ * Maps an image written by dict_save(); image.map is NULL if path is missing or not a valid image
+ * Validation reads the file once to verify its checksum; nothing is copied or allocated.
+ */
+/**
+ * Whether every key lies inside the arena, NUL-terminated right after len bytes with no NUL
+ * before, has the cached prefix, and sorts strictly after the previous key: the checksum only
+ * catches accidents, and mapped_dict_get() relies on all of these.
+ */
+static bool _dict_image_entries_valid(const struct dict_image_entry_t * entries, uint64_t size,
+                                      const char * arena, uint64_t arena_bytes) {
+    struct _dict_key_t prev;
+    for (uint64_t i = 0; i < size; ++i) {
+        const struct dict_image_entry_t * entry = entries + i;
+        if (entry->offset >= arena_bytes || entry->len >= arena_bytes - entry->offset) return false;
+        const char * str = arena + entry->offset;
+        if (str[entry->len] != '\0' || memchr(str, '\0', entry->len) != NULL) return false;
+        if (entry->prefix != _key_prefix(str, entry->len)) return false;
+        if (i > 0 && _key_cmp_parts(&prev, entry->prefix, entry->len, str) >= 0) return false;
+        prev.str = str;
+        prev.prefix = entry->prefix;
+        prev.len = entry->len;
+    }
+    return true;
+}
+
+struct mapped_dict_t dict_load_mmap(const char * path) {
+    assert(path != NULL);
+    struct mapped_dict_t image;
+    memset(&image, 0, sizeof(image));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return image;
+    struct stat st;
+    const struct _dict_image_header_t * header = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct _dict_image_header_t)) {
+        header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);  // the mapping stays valid
+    if (header == MAP_FAILED) return image;
+    size_t body_bytes = st.st_size - sizeof(struct _dict_image_header_t);
+    const char * body = (const char *)(header + 1);
+    if (header->magic != _DICT_IMAGE_MAGIC || header->version != _DICT_IMAGE_VERSION
+        || header->entry_size != sizeof(struct dict_image_entry_t) || header->size > UINT_MAX
+        || header->size > body_bytes / sizeof(struct dict_image_entry_t)
+        || header->arena_bytes != body_bytes - header->size * sizeof(struct dict_image_entry_t)
+        || header->checksum != _dict_image_checksum(body, body_bytes)
+        || !_dict_image_entries_valid((const struct dict_image_entry_t *)body, header->size,
+                                      body + header->size * sizeof(struct dict_image_entry_t),
+                                      header->arena_bytes)) {
+        munmap((void *)header, st.st_size);
+        return image;
+    }
+    image.entries = (const struct dict_image_entry_t *)body;
+    image.arena = body + header->size * sizeof(struct dict_image_entry_t);
+    image.size = header->size;
+    image.map = (void *)header;
+    image.map_bytes = st.st_size;
+    return image;
+}
+
+/** Returns the entry of key, or NULL; O(log n) comparisons, mostly on the cached prefixes */
+const struct dict_image_entry_t * mapped_dict_get(const struct mapped_dict_t * image, const char * key) {
+    assert(image != NULL && key != NULL);
+    struct _dict_key_t k = _dict_key(key);
+    unsigned lo = 0, hi = image->size;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        const struct dict_image_entry_t * entry = image->entries + mid;
+        int cmp = _key_cmp_parts(&k, entry->prefix, entry->len, image->arena + entry->offset);
+        if (cmp == 0) return entry;
+        if (cmp < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return NULL;
+}
+
+/** Fills an empty dict with the entries of image in O(n), for when writes are needed */
+void dict_build_from_mapped(dict_t * tree, const struct mapped_dict_t * image) {
+    assert(tree != NULL && tree->root == NULL && image != NULL);
+    struct dict_node_t ** sorted = malloc(sizeof(struct dict_node_t *) * (image->size + 1));
+    assert(sorted != NULL);
+    for (unsigned i = 0; i < image->size; ++i) {
+        const struct dict_image_entry_t * entry = image->entries + i;
+        struct _dict_key_t key;
+        key.str = image->arena + entry->offset;
+        key.prefix = entry->prefix;
+        key.len = entry->len;
+        sorted[i] = _create_avl_node(&key, entry->val, _DICT_POOL(tree));
+    }
+    tree->root = _avl_build(sorted, 0, image->size);
+    tree->size = image->size;
+    free(sorted);
+}
+
+void clear_mapped_dict(struct mapped_dict_t * image) {
+    assert(image != NULL);
+    if (image->map != NULL) munmap(image->map, image->map_bytes);
+    memset(image, 0, sizeof(*image));
+}
+
+/**
+ * Fills an empty dict from n keys in strcmp() order in O(n)
+ * Repeated keys keep their first value, as dict_add() would.
+ */
+void dict_build_from_sorted(dict_t * tree, const char * const * keys, const T * values, unsigned n) {
+    assert(tree != NULL && tree->root == NULL);
+    struct dict_node_t ** sorted = malloc(sizeof(struct dict_node_t *) * (n + 1));
+    assert(sorted != NULL);
+    unsigned count = 0;
+    for (unsigned i = 0; i < n; ++i) {
+        struct _dict_key_t key = _dict_key(keys[i]);
+        if (count > 0) {
+            int cmp = _key_cmp(&key, sorted[count - 1]);
+            assert(cmp >= 0);
+            if (cmp == 0) continue;
+        }
+        sorted[count++] = _create_avl_node(&key, values[i], _DICT_POOL(tree));
+    }
+    tree->root = _avl_build(sorted, 0, count);
+    tree->size = count;
+    free(sorted);
+}
+
+struct _dict_batch_item_t {
+    struct _dict_key_t key;
+    unsigned index;
+};
+
+static int _dict_batch_cmp(const void * a, const void * b) {
+    const struct _dict_batch_item_t * x = a, * y = b;
+    int cmp = _key_cmp_parts(&x->key, y->key.prefix, y->key.len, y->key.str);
+    if (cmp != 0) return cmp;
+    return x->index < y->index ? -1 : x->index > y->index;  // earlier entries win on duplicates
+}
+
+/**
+ * Inserts n unsorted keys, returns how many were new
+ * Values of keys already in the dict won't be updated. A batch that is large relative to the
+ * dict is sorted and merged with an in-order walk of the tree, then rebuilt in O(n + m).
+ */
+unsigned dict_batch_insert(dict_t * tree, const char * const * keys, const T * values, unsigned n) {
+    assert(tree != NULL);
+    unsigned old_size = tree->size;
+    unsigned depth = 32 - __builtin_clz(tree->size | 1);
+    if ((unsigned long long)n * depth < tree->size) {
+        for (unsigned i = 0; i < n; ++i) dict_add(tree, keys[i], values[i]);
+        return tree->size - old_size;
+    }
+    struct _dict_batch_item_t * batch = malloc(sizeof(struct _dict_batch_item_t) * (n + 1));
+    struct dict_node_t ** existing = malloc(sizeof(struct dict_node_t *) * (tree->size + 1));
+    struct dict_node_t ** merged = malloc(sizeof(struct dict_node_t *) * (tree->size + n + 1));
+    assert(batch != NULL && existing != NULL && merged != NULL);
+    for (unsigned i = 0; i < n; ++i) {
+        batch[i].key = _dict_key(keys[i]);
+        batch[i].index = i;
+    }
+    qsort(batch, n, sizeof(struct _dict_batch_item_t), _dict_batch_cmp);
+    unsigned count = 0;
+    _avl_collect(tree->root, existing, &count);
+    unsigned i = 0, j = 0, size = 0;
+    while (i < count || j < n) {
+        if (size > 0 && j < n && _key_cmp(&batch[j].key, merged[size - 1]) == 0) {
+            ++j;  // repeated in the batch, or already taken from the tree
+        } else if (j == n || (i < count && _key_cmp(&batch[j].key, existing[i]) >= 0)) {
+            merged[size++] = existing[i++];
+        } else {
+            merged[size++] = _create_avl_node(&batch[j].key, values[batch[j].index], _DICT_POOL(tree));
+            ++j;
+        }
+    }
+    tree->root = _avl_build(merged, 0, size);
+    tree->size = size;
+    free(batch);
+    free(existing);
+    free(merged);
+    return size - old_size;
+}
+
+#define _DICT_ITER_CURRENT(iter) ((iter)->depth > 0 ? (iter)->path[(iter)->depth - 1] : NULL)
+
+static void _dict_iter_init(struct dict_iter_t * iter, dict_t * tree) {
+    iter->depth = 0;
+    iter->at_end = false;
+    iter->root = tree->root;
+    iter->begin = iter->end = NULL;
+}
+
+/** Descends from node along left (dir = 0) or right (dir = 1) children */
+static struct dict_node_t * _dict_iter_descend(struct dict_iter_t * iter, struct dict_node_t * node, int dir) {
+    while (node != NULL) {
+        iter->path[iter->depth++] = node;
+        node = dir ? node->right : node->left;
+    }
+    return _DICT_ITER_CURRENT(iter);
+}
+
+struct dict_node_t * dict_iter_first(dict_t * tree, struct dict_iter_t * iter) {
+    assert(tree != NULL && iter != NULL);
+    _dict_iter_init(iter, tree);
+    return _dict_iter_descend(iter, tree->root, 0);
+}
+
+struct dict_node_t * dict_iter_last(dict_t * tree, struct dict_iter_t * iter) {
+    assert(tree != NULL && iter != NULL);
+    _dict_iter_init(iter, tree);
+    return _dict_iter_descend(iter, tree->root, 1);
+}
+
+/** Positions iter at the first node whose key is not less than key, and returns it */
+struct dict_node_t * dict_lower_bound(dict_t * tree, const char * key, struct dict_iter_t * iter) {
+    assert(tree != NULL && iter != NULL);
+    _dict_iter_init(iter, tree);
+    struct _dict_key_t k = _dict_key(key);
+    int found = 0;
+    struct dict_node_t * cursor = tree->root;
+    while (cursor != NULL) {
+        iter->path[iter->depth++] = cursor;
+        if (_key_cmp(&k, cursor) <= 0) {
+            found = iter->depth;
+            cursor = cursor->left;
+        } else {
+            cursor = cursor->right;
+        }
+    }
+    iter->depth = found;
+    iter->at_end = found == 0;
+    return _DICT_ITER_CURRENT(iter);
+}
+
+/** Positions iter at the first key of [lo, hi); next/prev stay inside the range */
+struct dict_node_t * dict_range(dict_t * tree, const char * lo, const char * hi, struct dict_iter_t * iter) {
+    assert(tree != NULL && iter != NULL);
+    struct dict_node_t * end = dict_lower_bound(tree, hi, iter);
+    struct dict_node_t * begin = dict_lower_bound(tree, lo, iter);
+    if (strcmp(lo, hi) >= 0 || begin == end) {
+        iter->depth = 0;
+        iter->at_end = false;
+        return NULL;
+    }
+    iter->begin = begin;
+    iter->end = end;
+    return begin;
+}
+
+struct dict_node_t * dict_iter_next(struct dict_iter_t * iter) {
+    assert(iter != NULL);
+    if (iter->depth == 0) return NULL;
+    struct dict_node_t * current = iter->path[iter->depth - 1];
+    if (current->right != NULL) {
+        _dict_iter_descend(iter, current->right, 0);
+    } else {  // climb until we come up from a left child
+        struct dict_node_t * child;
+        do {
+            child = iter->path[--iter->depth];
+        } while (iter->depth > 0 && iter->path[iter->depth - 1]->right == child);
+    }
+    if (iter->depth > 0 && iter->path[iter->depth - 1] == iter->end) iter->depth = 0;
+    iter->at_end = iter->depth == 0;
+    return _DICT_ITER_CURRENT(iter);
+}
+
+/** Rebuilds the path down to node, which is in the dict */
+static void _dict_iter_seek(struct dict_iter_t * iter, struct dict_node_t * node) {
+    struct _dict_key_t k = _dict_key(node->key);
+    struct dict_node_t * cursor = iter->root;
+    iter->depth = 0;
+    while (cursor != NULL) {
+        iter->path[iter->depth++] = cursor;
+        int cmp = _key_cmp(&k, cursor);
+        if (cmp == 0) break;
+        cursor = cmp < 0 ? cursor->left : cursor->right;
+    }
+}
+
+struct dict_node_t * dict_iter_prev(struct dict_iter_t * iter) {
+    assert(iter != NULL);
+    if (iter->at_end) {  // back onto the last node, or the one before the range end
+        iter->at_end = false;
+        if (iter->end == NULL) return _dict_iter_descend(iter, iter->root, 1);
+        _dict_iter_seek(iter, iter->end);
+    }
+    if (iter->depth == 0) return NULL;
+    struct dict_node_t * current = iter->path[iter->depth - 1];
+    if (current == iter->begin) {
+        iter->depth = 0;
+    } else if (current->left != NULL) {
+        _dict_iter_descend(iter, current->left, 1);
+    } else {  // climb until we come up from a right child
+        struct dict_node_t * child;
+        do {
+            child = iter->path[--iter->depth];
+        } while (iter->depth > 0 && iter->path[iter->depth - 1]->left == child);
+    }
+    return _DICT_ITER_CURRENT(iter);
+}
+
+#ifdef AVL_ORDER_STATISTICS
+/** Number of keys less than key */
+unsigned dict_rank(dict_t * tree, const char * key) {
     assert(tree != NULL);
-    tree->root = _avl_delete(tree->root, key);
-    tree->size--;
+    struct _dict_key_t k = _dict_key(key);
+    unsigned rank = 0;
+    struct dict_node_t * cursor = tree->root;
+    while (cursor != NULL) {
+        if (_key_cmp(&k, cursor) <= 0) {
+            cursor = cursor->left;
+        } else {
+            rank += _AVL_COUNT(cursor->left) + 1;
+            cursor = cursor->right;
+        }
+    }
+    return rank;
+}
+
+/** Positions iter at the node of rank i (0-based), and returns it */
+struct dict_node_t * dict_select(dict_t * tree, unsigned i, struct dict_iter_t * iter) {
+    assert(tree != NULL && iter != NULL);
+    _dict_iter_init(iter, tree);
+    struct dict_node_t * cursor = tree->root;
+    while (cursor != NULL) {
+        iter->path[iter->depth++] = cursor;
+        unsigned left = _AVL_COUNT(cursor->left);
+        if (i < left) {
+            cursor = cursor->left;
+        } else if (i > left) {
+            i -= left + 1;
+            cursor = cursor->right;
+        } else {
+            return cursor;
+        }
+    }
+    iter->depth = 0;
+    return NULL;
+}
+#endif
+
+/** Hangs L and R below node k, rebalancing along the spine of the taller side, O(|h(L) - h(R)|) */
+static struct dict_node_t * _avl_join(struct dict_node_t * left, struct dict_node_t * k, struct dict_node_t * right) {
+    if (_AVL_HEIGHT(left) > _AVL_HEIGHT(right) + 1) {
+        left->right = _avl_join(left->right, k, right);
+        return _avl_maintain(left);
+    } else if (_AVL_HEIGHT(right) > _AVL_HEIGHT(left) + 1) {
+        right->left = _avl_join(left, k, right->left);
+        return _avl_maintain(right);
+    }
+    k->left = left;
+    k->right = right;
+    _avl_update_height(k);
+    return k;
+}
+
+/** Like _avl_join() when every key of L is less than every key of R, but without a middle node */
+static struct dict_node_t * _avl_join2(struct dict_node_t * left, struct dict_node_t * right) {
+    if (left == NULL) return right;
+    if (right == NULL) return left;
+    struct dict_node_t * min = _avl_min(right);
+    return _avl_join(left, min, _avl_exclude_min(right));
+}
+
+/**
+ * Splits tree into the keys less than and greater than key, in O(log n)
+ * Returns the node holding key, detached from both halves, or NULL.
+ */
+static struct dict_node_t * _avl_split(struct dict_node_t * tree, const struct _dict_key_t * key,
+                                      struct dict_node_t ** less, struct dict_node_t ** greater) {
+    if (tree == NULL) {
+        *less = *greater = NULL;
+        return NULL;
+    }
+    int cmp = _key_cmp(key, tree);
+    struct dict_node_t * found;
+    if (cmp < 0) {
+        found = _avl_split(tree->left, key, less, greater);
+        *greater = _avl_join(*greater, tree, tree->right);
+    } else if (cmp > 0) {
+        found = _avl_split(tree->right, key, less, greater);
+        *less = _avl_join(tree->left, tree, *less);
+    } else {
+        found = tree;
+        *less = tree->left;
+        *greater = tree->right;
+        tree->left = tree->right = NULL;
+    }
+    return found;
+}
+
+enum { _DICT_UNION, _DICT_INTERSECTION, _DICT_DIFFERENCE };
+
+#define _DICT_FORK_HEIGHT 10  // subproblems whose smaller tree is lower than this run inline
+
+/** One recursive call of a set operation, packed so that it can run as a forked task */
+struct _dict_setop_t {
+    int op;
+    struct dict_node_t * a, * b;
+    struct thread_pool_t * threads;
+    struct dict_node_t * result;
+    struct dict_node_t * garbage, * garbage_tail;  // dropped nodes, linked through left
+    unsigned dropped;
+};
+
+/** Nodes are only released by the caller, since a pooled dict's free-list isn't thread-safe */
+static void _dict_drop(struct _dict_setop_t * op, struct dict_node_t * node) {
+    node->left = op->garbage;
+    op->garbage = node;
+    if (op->garbage_tail == NULL) op->garbage_tail = node;
+    op->dropped++;
+}
+
+/** Flattens a whole subtree onto the garbage list, rotating instead of recursing */
+static void _dict_drop_tree(struct _dict_setop_t * op, struct dict_node_t * tree) {
+    while (tree != NULL) {
+        if (tree->left != NULL) {
+            struct dict_node_t * left = tree->left;
+            tree->left = left->right;
+            left->right = tree;
+            tree = left;
+        } else {
+            struct dict_node_t * right = tree->right;
+            _dict_drop(op, tree);
+            tree = right;
+        }
+    }
+}
+
+static void _dict_setop(void * arg);
+
+static void _dict_setop_init(struct _dict_setop_t * op, const struct _dict_setop_t * parent,
+                             struct dict_node_t * a, struct dict_node_t * b) {
+    op->op = parent->op;
+    op->a = a;
+    op->b = b;
+    op->threads = parent->threads;
+    op->garbage = op->garbage_tail = NULL;
+    op->dropped = 0;
+}
+
+static void _dict_setop_adopt(struct _dict_setop_t * op, struct _dict_setop_t * child) {
+    if (child->garbage == NULL) return;
+    child->garbage_tail->left = op->garbage;
+    op->garbage = child->garbage;
+    if (op->garbage_tail == NULL) op->garbage_tail = child->garbage_tail;
+    op->dropped += child->dropped;
+}
+
+/**
+ * Splits one tree by the root of the other, solves both halves (the left one as a forked task
+ * when big enough) and joins the results. Keys and values of a win over those of b.
+ */
+static void _dict_setop(void * arg) {
+    struct _dict_setop_t * op = arg;
+    struct dict_node_t * a = op->a, * b = op->b;
+    if (a == NULL || b == NULL) {
+        if (op->op == _DICT_UNION) {
+            op->result = a ? a : b;
+        } else if (op->op == _DICT_INTERSECTION) {
+            _dict_drop_tree(op, a ? a : b);
+            op->result = NULL;
+        } else {
+            _dict_drop_tree(op, b);
+            op->result = a;
+        }
+        return;
+    }
+    // difference splits a by the root of b, the others split b by the root of a
+    struct dict_node_t * pivot = op->op == _DICT_DIFFERENCE ? b : a;
+    struct dict_node_t * other = op->op == _DICT_DIFFERENCE ? a : b;
+    struct _dict_key_t key = {pivot->key, pivot->prefix, pivot->len};
+    struct dict_node_t * less, * greater;
+    struct dict_node_t * found = _avl_split(other, &key, &less, &greater);
+    struct _dict_setop_t left, right;
+    if (op->op == _DICT_DIFFERENCE) {
+        _dict_setop_init(&left, op, less, pivot->left);
+        _dict_setop_init(&right, op, greater, pivot->right);
+    } else {
+        _dict_setop_init(&left, op, pivot->left, less);
+        _dict_setop_init(&right, op, pivot->right, greater);
+    }
+    int a_height = _AVL_HEIGHT(a), b_height = _AVL_HEIGHT(b);
+    if (op->threads != NULL && (a_height < b_height ? a_height : b_height) >= _DICT_FORK_HEIGHT) {
+        struct task_t task = {_dict_setop, &left, 0};
+        thread_pool_fork(op->threads, &task);
+        _dict_setop(&right);
+        thread_pool_join(op->threads, &task);
+    } else {
+        _dict_setop(&left);
+        _dict_setop(&right);
+    }
+    _dict_setop_adopt(op, &left);
+    _dict_setop_adopt(op, &right);
+    if (op->op == _DICT_UNION) {
+        if (found) _dict_drop(op, found);
+        op->result = _avl_join(left.result, pivot, right.result);
+    } else if (op->op == _DICT_INTERSECTION) {
+        if (found) {
+            _dict_drop(op, found);
+            op->result = _avl_join(left.result, pivot, right.result);
+        } else {
+            _dict_drop(op, pivot);
+            op->result = _avl_join2(left.result, right.result);
+        }
+    } else {
+        if (found) _dict_drop(op, found);
+        _dict_drop(op, pivot);
+        op->result = _avl_join2(left.result, right.result);
+    }
+}
+
+static void _dict_set_operation(dict_t * tree, dict_t * other, struct thread_pool_t * threads, int kind) {
+    assert(tree != NULL && other != NULL && tree != other);
+    assert((tree->pool.obj_size > 0) == (other->pool.obj_size > 0));  // nodes change hands
+    if (tree->pool.obj_size > 0) pool_merge(&tree->pool, &other->pool);
+    struct _dict_setop_t op;
+    op.op = kind;
+    op.a = tree->root;
+    op.b = other->root;
+    op.threads = threads;
+    op.garbage = op.garbage_tail = NULL;
+    op.dropped = 0;
+    _dict_setop(&op);
+    tree->root = op.result;
+    tree->size = tree->size + other->size - op.dropped;
+    other->root = NULL;
+    other->size = 0;
+    while (op.garbage != NULL) {
+        struct dict_node_t * next = op.garbage->left;
+        _destroy_avl_node(op.garbage, _DICT_POOL(tree));
+        op.garbage = next;
+    }
+}
+
+/**
+ * Set operations in O(m log(n/m + 1)) work for sizes m <= n, consuming other
+ * tree receives the result and other is left empty. Where both contain a key, tree's node and
+ * value are kept. Subtrees are processed in parallel on threads, or sequentially if it is NULL.
+ * Both dicts must be pooled or both not; a pooled other hands its slabs over to tree.
+ */
+void dict_union(dict_t * tree, dict_t * other, struct thread_pool_t * threads) {
+    _dict_set_operation(tree, other, threads, _DICT_UNION);
+}
+
+void dict_intersection(dict_t * tree, dict_t * other, struct thread_pool_t * threads) {
+    _dict_set_operation(tree, other, threads, _DICT_INTERSECTION);
+}
+
+void dict_difference(dict_t * tree, dict_t * other, struct thread_pool_t * threads) {
+    _dict_set_operation(tree, other, threads, _DICT_DIFFERENCE);
 }
@@ -1,25 +1,179 @@
 #ifndef DICT_H
 #define DICT_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "pool.h"
+#include "stats.h"
+
 typedef int T;
 
-struct avl_node_t {
-    char * key;
-    T val;
-    struct avl_node_t * left, * right;
+#define DICT_INLINE_KEY 16  // keys shorter than this live inside the node
+#define DICT_BATCH_LANES 16  // lookups dict_get_many() keeps in flight
+
+/**
+ * 64 bytes: the fields a search reads come first, and a cached prefix and length let
+ * most comparisons finish without loading the key bytes
+ */
+struct dict_node_t {
+    uint64_t prefix;  // first 8 key bytes, big-endian, zero padded
+    struct dict_node_t * left, * right;
+    char * key;  // points at inline_key for short keys
+    unsigned len;
     int height;
+    T val;
+#ifdef AVL_ORDER_STATISTICS
+    unsigned count;  // nodes in this subtree, fits in the padding before inline_key
+#endif
+    char inline_key[DICT_INLINE_KEY];
 };
 
 typedef struct dict_t {
-    struct avl_node_t * root;
+    struct dict_node_t * root;
     unsigned size;
+    struct pool_t pool;  // nodes and keys come from here if pool.obj_size > 0
 } dict_t;
 
 dict_t create_dict(void);
+dict_t create_dict_pooled(void);
 void clear_dict(dict_t * dict);
-struct avl_node_t * dict_add(dict_t * dict, const char * key, T value);
-struct avl_node_t * dict_get(dict_t dict, const char * key);
+struct dict_node_t * dict_add(dict_t * dict, const char * key, T value);
+struct dict_node_t * dict_get(dict_t dict, const char * key);
+void dict_get_many(dict_t dict, const char * const * keys, unsigned n, struct dict_node_t ** results);
 void dict_set(dict_t * dict, const char * key, T value);
 void dict_delete(dict_t * dict, const char * key);
+struct dict_node_t * dict_detach(dict_t * dict, const char * key);
+void dict_release_node(dict_t * dict, struct dict_node_t * node);
+T * dict_find_or_insert(dict_t * dict, const char * key, T value, bool * inserted);
+T * dict_upsert(dict_t * dict, const char * key, T value);
+void dict_build_from_sorted(dict_t * dict, const char * const * keys, const T * values, unsigned n);
+unsigned dict_batch_insert(dict_t * dict, const char * const * keys, const T * values, unsigned n);
+
+struct thread_pool_t;
+void dict_union(dict_t * dict, dict_t * other, struct thread_pool_t * threads);
+void dict_intersection(dict_t * dict, dict_t * other, struct thread_pool_t * threads);
+void dict_difference(dict_t * dict, dict_t * other, struct thread_pool_t * threads);
+
+#define DICT_MAX_HEIGHT 64  // an AVL tree of height 64 holds more than 2^44 nodes
+
+/**
+ * Cursor over a dict in key order, holding the path from the root to the current node
+ * Needs no allocation and no parent pointers; any modification of the dict invalidates it.
+ * Past the last node (or the range), the cursor is at the end: prev() steps back onto it.
+ */
+struct dict_iter_t {
+    struct dict_node_t * path[DICT_MAX_HEIGHT];
+    int depth;  // 0 once the cursor has left the dict or its range
+    bool at_end;  // depth is 0 because the cursor went past the last node
+    struct dict_node_t * root;
+    struct dict_node_t * begin, * end;  // range bounds, NULL when unbounded
+};
+
+struct dict_node_t * dict_iter_first(dict_t * dict, struct dict_iter_t * iter);
+struct dict_node_t * dict_iter_last(dict_t * dict, struct dict_iter_t * iter);
+struct dict_node_t * dict_lower_bound(dict_t * dict, const char * key, struct dict_iter_t * iter);
+struct dict_node_t * dict_range(dict_t * dict, const char * lo, const char * hi, struct dict_iter_t * iter);
+struct dict_node_t * dict_iter_next(struct dict_iter_t * iter);
+struct dict_node_t * dict_iter_prev(struct dict_iter_t * iter);
+
+/*
+ * Compiling everything with -DAVL_ORDER_STATISTICS keeps a subtree size in every node,
+ * which makes rank and select O(log n)
+ */
+#ifdef AVL_ORDER_STATISTICS
+unsigned dict_rank(dict_t * dict, const char * key);
+struct dict_node_t * dict_select(dict_t * dict, unsigned i, struct dict_iter_t * iter);
+#endif
+
+#ifdef DS_STATS
+struct avl_stats_t dict_stats(void);  // see stats.h
+#endif
+
+/**
+ * Read-only snapshot of a dict for lookups after the load phase
+ * The cached key prefixes are packed, in Eytzinger order, into one cache-line-aligned array,
+ * so the search only reads nodes to break prefix ties.
+ * nodes[] point into the dict, which must stay unmodified while the snapshot is in use.
+ */
+struct frozen_dict_t {
+    uint64_t * prefixes;  // 1-based Eytzinger order, prefixes[0] is padding
+    unsigned * ranks;     // in-order position of each Eytzinger slot
+    struct dict_node_t ** nodes;  // in-order
+    unsigned size;
+};
+
+struct frozen_dict_t dict_freeze(const dict_t * dict);
+struct dict_node_t * frozen_dict_get(const struct frozen_dict_t * frozen, const char * key);
+void clear_frozen_dict(struct frozen_dict_t * frozen);
+
+/** A key of a saved dict: its bytes are at arena + offset, NUL-terminated */
+struct dict_image_entry_t {
+    uint64_t prefix;
+    uint64_t offset;
+    unsigned len;
+    T val;
+};
+
+/**
+ * Dict image written by dict_save(), mapped read-only by dict_load_mmap()
+ * Entries are in key order, followed by all keys in one string arena; lookups are binary
+ * searches over the mapped file, with no per-key allocation.
+ */
+struct mapped_dict_t {
+    const struct dict_image_entry_t * entries;
+    const char * arena;
+    unsigned size;
+    void * map;  // NULL if the image could not be loaded
+    size_t map_bytes;
+};
+
+bool dict_save(const dict_t * dict, const char * path);
+struct mapped_dict_t dict_load_mmap(const char * path);
+const struct dict_image_entry_t * mapped_dict_get(const struct mapped_dict_t * image, const char * key);
+void dict_build_from_mapped(dict_t * dict, const struct mapped_dict_t * image);
+void clear_mapped_dict(struct mapped_dict_t * image);
+
+/*
+ * Building client code with -DDICT_USE_HASH points the calls above at the unordered hash table
+ * of hash_dict.h. Its entries also have key and val fields, so node->val keeps working.
+ * Calls that rely on key order, node ownership or the AVL layout have no hash counterpart:
+ * they are poisoned, so using one is a compile error rather than a dict_t / hash_dict_t mixup.
+ */
+#ifdef DICT_USE_HASH
+#include "hash_dict.h"
+
+inline static void _hash_dict_build(hash_dict_t * dict, const char * const * keys, const T * values, unsigned n) {
+    for (unsigned i = 0; i < n; ++i) hash_dict_add(dict, keys[i], values[i]);
+}
+
+inline static unsigned _hash_dict_batch_insert(hash_dict_t * dict, const char * const * keys, const T * values,
+                                               unsigned n) {
+    unsigned inserted = 0;
+    for (unsigned i = 0; i < n; ++i) inserted += hash_dict_add(dict, keys[i], values[i]) != NULL;
+    return inserted;
+}
+
+#define dict_t hash_dict_t
+#define dict_node_t hash_dict_entry_t
+#define create_dict create_hash_dict
+#define create_dict_pooled create_hash_dict  // the table is a single allocation anyway
+#define clear_dict clear_hash_dict
+#define dict_add hash_dict_add
+#define dict_get hash_dict_get
+#define dict_get_many hash_dict_get_many
+#define dict_set hash_dict_set
+#define dict_delete hash_dict_delete
+#define dict_find_or_insert hash_dict_find_or_insert
+#define dict_upsert hash_dict_upsert
+#define dict_build_from_sorted _hash_dict_build
+#define dict_batch_insert _hash_dict_batch_insert
+
+#pragma GCC poison dict_union dict_intersection dict_difference
+#pragma GCC poison dict_iter_t dict_iter_first dict_iter_last dict_lower_bound dict_range dict_iter_next dict_iter_prev
+#pragma GCC poison dict_rank dict_select dict_stats
+#pragma GCC poison frozen_dict_t dict_freeze frozen_dict_get clear_frozen_dict
+#pragma GCC poison dict_image_entry_t mapped_dict_t dict_save dict_load_mmap mapped_dict_get dict_build_from_mapped
+#pragma GCC poison clear_mapped_dict dict_detach dict_release_node
+#endif
 
 #endif
@@ -0,0 +1,56 @@
+#ifndef DICT_KEY_H
+#define DICT_KEY_H
+
+/*
+ * String key helpers shared by the AVL dict flavours, for nodes that cache
+ * the key's prefix and len next to key. Internal: not part of the dict API.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+/** First 8 bytes of key as a big-endian integer, zero padded: compares like strcmp() on them */
+inline static uint64_t _key_prefix(const char * key, size_t len) {
+    uint64_t prefix = 0;
+    if (len >= 8) {
+        memcpy(&prefix, key, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        prefix = __builtin_bswap64(prefix);
+#endif
+        return prefix;
+    }
+    for (size_t i = 0; i < len; ++i) prefix |= (uint64_t)(unsigned char)key[i] << (56 - 8 * i);
+    return prefix;
+}
+
+/** A search key, measured once per operation */
+struct _dict_key_t {
+    const char * str;
+    uint64_t prefix;
+    unsigned len;
+};
+
+inline static struct _dict_key_t _dict_key(const char * str) {
+    struct _dict_key_t key;
+    key.str = str;
+    key.len = strlen(str);
+    key.prefix = _key_prefix(str, key.len);
+    return key;
+}
+
+/**
+ * Same sign as strcmp(key->str, str), where str has the given prefix and length
+ * Key bytes are only read when the 8-byte prefixes tie and both keys are longer than that.
+ */
+inline static int _key_cmp_parts(const struct _dict_key_t * key, uint64_t prefix, unsigned len, const char * str) {
+    if (key->prefix != prefix) return key->prefix < prefix ? -1 : 1;
+    if (key->len > 8 && len > 8) {
+        int cmp = memcmp(key->str + 8, str + 8, (key->len < len ? key->len : len) - 8);
+        if (cmp != 0) return cmp;
+    }
+    return (key->len > len) - (key->len < len);
+}
+
+#define _key_cmp(search, node) _key_cmp_parts((search), (node)->prefix, (node)->len, (node)->key)
+
+#endif
@@ -0,0 +1,283 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash_dict.h"
+
+#define _HD_EMPTY ((int8_t)-128)   // 0b10000000
+#define _HD_DELETED ((int8_t)-2)   // 0b11111110, full slots are 0b0xxxxxxx
+
+/*
+ * Group probing: a mask has one set bit per matching slot of a group.
+ * SIMD masks use bit i for slot i; the SWAR mask uses bit 8i+7.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define _HD_GROUP 32
+#define _HD_SHIFT 0
+typedef uint32_t _hd_mask_t;
+
+inline static _hd_mask_t _hd_match(const int8_t * ctrl, int8_t h2) {
+    __m256i group = _mm256_loadu_si256((const __m256i *)ctrl);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_set1_epi8(h2)));
+}
+
+inline static _hd_mask_t _hd_match_empty(const int8_t * ctrl) {
+    return _hd_match(ctrl, _HD_EMPTY);
+}
+
+inline static _hd_mask_t _hd_match_free(const int8_t * ctrl) {  // empty or deleted
+    return (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)ctrl));
+}
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define _HD_GROUP 16
+#define _HD_SHIFT 0
+typedef uint32_t _hd_mask_t;
+
+inline static _hd_mask_t _hd_match(const int8_t * ctrl, int8_t h2) {
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+}
+
+inline static _hd_mask_t _hd_match_empty(const int8_t * ctrl) {
+    return _hd_match(ctrl, _HD_EMPTY);
+}
+
+inline static _hd_mask_t _hd_match_free(const int8_t * ctrl) {
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+
+#else
+#define _HD_GROUP 8
+#define _HD_SHIFT 3
+typedef uint64_t _hd_mask_t;
+
+#define _HD_LSBS 0x0101010101010101ULL
+#define _HD_MSBS 0x8080808080808080ULL
+
+inline static uint64_t _hd_load(const int8_t * ctrl) {
+    uint64_t group;
+    memcpy(&group, ctrl, sizeof(group));
+    return group;
+}
+
+/** May report false positives next to a true match, which the key compare filters out */
+inline static _hd_mask_t _hd_match(const int8_t * ctrl, int8_t h2) {
+    uint64_t x = _hd_load(ctrl) ^ (_HD_LSBS * (uint8_t)h2);
+    return (x - _HD_LSBS) & ~x & _HD_MSBS;
+}
+
+inline static _hd_mask_t _hd_match_empty(const int8_t * ctrl) {
+    uint64_t group = _hd_load(ctrl);
+    return group & ~(group << 6) & _HD_MSBS;
+}
+
+inline static _hd_mask_t _hd_match_free(const int8_t * ctrl) {
+    return _hd_load(ctrl) & _HD_MSBS;
+}
+#endif
+
+/** Pops the lowest matching slot of a mask, relative to the group start */
+inline static unsigned _hd_next(_hd_mask_t * mask) {
+    unsigned index = (unsigned)__builtin_ctzll(*mask) >> _HD_SHIFT;
+    *mask &= *mask - 1;
+#if _HD_SHIFT > 0 && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    index = _HD_GROUP - 1 - index;
+#endif
+    return index;
+}
+
+inline static uint64_t _hd_hash(const char * key, size_t len) {
+    const uint64_t m = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = len * m;
+    uint64_t word;
+    for (; len >= 8; key += 8, len -= 8) {
+        memcpy(&word, key, 8);
+        h = (h ^ word) * m;
+        h ^= h >> 29;
+    }
+    word = 0;
+    memcpy(&word, key, len);
+    h = (h ^ word) * m;
+    h ^= h >> 32;
+    h *= 0xd6e8feb86659fd93ULL;
+    return h ^ (h >> 32);
+}
+
+#define _HD_H1(hash) ((hash) >> 7)
+#define _HD_H2(hash) ((int8_t)((hash) & 0x7f))
+#define _HD_MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+/** The first _HD_GROUP - 1 control bytes are mirrored past the end so that groups never wrap */
+inline static void _hd_set_ctrl(hash_dict_t * dict, unsigned index, int8_t ctrl) {
+    dict->ctrl[index] = ctrl;
+    dict->ctrl[((index - (_HD_GROUP - 1)) & (dict->capacity - 1)) + (_HD_GROUP - 1)] = ctrl;
+}
+
+hash_dict_t create_hash_dict(void) {
+    hash_dict_t dict;
+    dict.ctrl = NULL;
+    dict.entries = NULL;
+    dict.size = dict.capacity = dict.growth_left = 0;
+    return dict;
+}
+
+void clear_hash_dict(hash_dict_t * dict) {
+    assert(dict != NULL);
+    for (unsigned i = 0; i < dict->capacity; ++i) {
+        if (dict->ctrl[i] >= 0) free(dict->entries[i].key);
+    }
+    free(dict->ctrl);
+    free(dict->entries);
+    *dict = create_hash_dict();
+}
+
+/** Returns the slot holding key, or -1 */
+static long _hd_find(const hash_dict_t * dict, const char * key, uint64_t hash) {
+    if (dict->capacity == 0) return -1;
+    unsigned mask = dict->capacity - 1;
+    unsigned pos = _HD_H1(hash) & mask;
+    for (unsigned step = _HD_GROUP;; pos = (pos + step) & mask, step += _HD_GROUP) {
+        const int8_t * group = dict->ctrl + pos;
+        _hd_mask_t match = _hd_match(group, _HD_H2(hash));
+        while (match) {
+            unsigned index = (pos + _hd_next(&match)) & mask;
+            const struct hash_dict_entry_t * entry = dict->entries + index;
+            if (entry->hash == hash && strcmp(entry->key, key) == 0) return index;
+        }
+        if (_hd_match_empty(group)) return -1;
+    }
+}
+
+/** First empty or deleted slot on the probe sequence of hash */
+static unsigned _hd_find_free(const hash_dict_t * dict, uint64_t hash) {
+    unsigned mask = dict->capacity - 1;
+    unsigned pos = _HD_H1(hash) & mask;
+    for (unsigned step = _HD_GROUP;; pos = (pos + step) & mask, step += _HD_GROUP) {
+        _hd_mask_t match = _hd_match_free(dict->ctrl + pos);
+        if (match) return (pos + _hd_next(&match)) & mask;
+    }
+}
+
+/** Moves every entry into fresh arrays of new_capacity slots, dropping tombstones */
+static void _hd_rehash(hash_dict_t * dict, unsigned new_capacity) {
+    hash_dict_t old = *dict;
+    dict->capacity = new_capacity;
+    dict->ctrl = malloc(new_capacity + _HD_GROUP - 1);
+    dict->entries = malloc(sizeof(struct hash_dict_entry_t) * new_capacity);
+    assert(dict->ctrl != NULL && dict->entries != NULL);
+    memset(dict->ctrl, (uint8_t)_HD_EMPTY, new_capacity + _HD_GROUP - 1);
+    for (unsigned i = 0; i < old.capacity; ++i) {
+        if (old.ctrl[i] < 0) continue;
+        unsigned index = _hd_find_free(dict, old.entries[i].hash);
+        _hd_set_ctrl(dict, index, old.ctrl[i]);
+        dict->entries[index] = old.entries[i];
+    }
+    dict->growth_left = _HD_MAX_LOAD(new_capacity) - dict->size;
+    free(old.ctrl);
+    free(old.entries);
+}
+
+/**
+ * Returns the slot of key, creating an entry with value if key is absent
+ * *inserted tells which case happened
+ */
+static unsigned _hd_insert(hash_dict_t * dict, const char * key, T value, bool * inserted) {
+    size_t len = strlen(key);
+    uint64_t hash = _hd_hash(key, len);
+    long found = _hd_find(dict, key, hash);
+    if (found >= 0) {
+        *inserted = false;
+        return (unsigned)found;
+    }
+    unsigned index = dict->capacity ? _hd_find_free(dict, hash) : 0;
+    if (dict->capacity == 0 || (dict->growth_left == 0 && dict->ctrl[index] == _HD_EMPTY)) {
+        // grow, unless most of the load is tombstones that a same-size rehash reclaims
+        unsigned capacity = dict->capacity == 0 ? _HD_GROUP : dict->capacity;
+        if (dict->size >= _HD_MAX_LOAD(capacity) / 2) capacity *= 2;
+        _hd_rehash(dict, capacity);
+        index = _hd_find_free(dict, hash);
+    }
+    if (dict->ctrl[index] == _HD_EMPTY) dict->growth_left--;
+    _hd_set_ctrl(dict, index, _HD_H2(hash));
+    struct hash_dict_entry_t * entry = dict->entries + index;
+    entry->key = malloc(len + 1);
+    assert(entry->key != NULL);
+    memcpy(entry->key, key, len + 1);
+    entry->val = value;
+    entry->hash = hash;
+    dict->size++;
+    *inserted = true;
+    return index;
+}
+
+/**
+ * Returns the address of inserted entry, or NULL if dict already contains the same key
+ * When duplicate, values won't be updated
+ */
+struct hash_dict_entry_t * hash_dict_add(hash_dict_t * dict, const char * key, T value) {
+    assert(dict != NULL);
+    bool inserted;
+    unsigned index = _hd_insert(dict, key, value, &inserted);
+    return inserted ? dict->entries + index : NULL;
+}
+
+/** Returns the address of an entry with given key, or NULL if not found */
+struct hash_dict_entry_t * hash_dict_get(hash_dict_t dict, const char * key) {
+    long index = _hd_find(&dict, key, _hd_hash(key, strlen(key)));
+    return index >= 0 ? dict.entries + index : NULL;
+}
+
+#define _HD_BATCH 16
+
+/** results[i] = hash_dict_get(dict, keys[i]); the first group of every probe is prefetched ahead */
+void hash_dict_get_many(hash_dict_t dict, const char * const * keys, unsigned n, struct hash_dict_entry_t ** results) {
+    assert(n == 0 || (keys != NULL && results != NULL));
+    uint64_t hashes[_HD_BATCH];
+    for (unsigned base = 0; base < n; base += _HD_BATCH) {
+        unsigned count = n - base < _HD_BATCH ? n - base : _HD_BATCH;
+        for (unsigned i = 0; i < count; ++i) {
+            hashes[i] = _hd_hash(keys[base + i], strlen(keys[base + i]));
+            if (dict.capacity == 0) continue;
+            unsigned pos = _HD_H1(hashes[i]) & (dict.capacity - 1);
+            __builtin_prefetch(dict.ctrl + pos);
+            __builtin_prefetch(dict.entries + pos);
+        }
+        for (unsigned i = 0; i < count; ++i) {
+            long index = _hd_find(&dict, keys[base + i], hashes[i]);
+            results[base + i] = index >= 0 ? dict.entries + index : NULL;
+        }
+    }
+}
+
+void hash_dict_set(hash_dict_t * dict, const char * key, T value) {
+    hash_dict_upsert(dict, key, value);
+}
+
+/** See dict_find_or_insert(); the address is valid until the next insertion */
+T * hash_dict_find_or_insert(hash_dict_t * dict, const char * key, T value, bool * inserted) {
+    assert(dict != NULL);
+    bool created;
+    unsigned index = _hd_insert(dict, key, value, &created);
+    if (inserted) *inserted = created;
+    return &dict->entries[index].val;
+}
+
+T * hash_dict_upsert(hash_dict_t * dict, const char * key, T value) {
+    bool inserted;
+    T * val = hash_dict_find_or_insert(dict, key, value, &inserted);
+    if (!inserted) *val = value;
+    return val;
+}
+
+/** inexistent key will cause an error */
+void hash_dict_delete(hash_dict_t * dict, const char * key) {
+    assert(dict != NULL);
+    long index = _hd_find(dict, key, _hd_hash(key, strlen(key)));
+    assert(index >= 0);
+    free(dict->entries[index].key);
+    // a tombstone keeps probe sequences that ran through this slot intact
+    _hd_set_ctrl(dict, (unsigned)index, _HD_DELETED);
+    dict->size--;
+}
@@ -0,0 +1,39 @@
+#ifndef HASH_DICT_H
+#define HASH_DICT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef int T;
+
+struct hash_dict_entry_t {
+    char * key;
+    T val;
+    uint64_t hash;  // cached so that probing and rehashing never rehash the key
+};
+
+/**
+ * Open-addressing hash table with one control byte per slot
+ * A full slot's control byte holds 7 bits of the key's hash, so a whole group of slots
+ * is filtered with a single SIMD compare (SSE2/AVX2) or a SWAR word compare.
+ * Entry addresses are only valid until the next insertion.
+ */
+typedef struct hash_dict_t {
+    int8_t * ctrl;
+    struct hash_dict_entry_t * entries;
+    unsigned size;
+    unsigned capacity;     // 0 or a power of two
+    unsigned growth_left;  // empty slots that may still be filled before growing
+} hash_dict_t;
+
+hash_dict_t create_hash_dict(void);
+void clear_hash_dict(hash_dict_t * dict);
+struct hash_dict_entry_t * hash_dict_add(hash_dict_t * dict, const char * key, T value);
+struct hash_dict_entry_t * hash_dict_get(hash_dict_t dict, const char * key);
+void hash_dict_get_many(hash_dict_t dict, const char * const * keys, unsigned n, struct hash_dict_entry_t ** results);
+void hash_dict_set(hash_dict_t * dict, const char * key, T value);
+T * hash_dict_find_or_insert(hash_dict_t * dict, const char * key, T value, bool * inserted);
+T * hash_dict_upsert(hash_dict_t * dict, const char * key, T value);
+void hash_dict_delete(hash_dict_t * dict, const char * key);
+
+#endif
@@ -0,0 +1,270 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "persistent_dict.h"
+#include "dict_key.h"
+
+/** Key bytes, shared by all copies of a node instead of being duplicated per version */
+struct _persistent_key_t {
+    unsigned refs;
+    char str[];
+};
+
+#define _PERSISTENT_KEY(node) ((struct _persistent_key_t *)((node)->key - offsetof(struct _persistent_key_t, str)))
+
+#define _PERSISTENT_REF(obj) __atomic_add_fetch(&(obj)->refs, 1, __ATOMIC_RELAXED)
+#define _PERSISTENT_UNREF(obj) (__atomic_sub_fetch(&(obj)->refs, 1, __ATOMIC_ACQ_REL) == 0)
+
+static struct persistent_node_t * _create_persistent_node(const struct _dict_key_t * key, T value) {
+    struct persistent_node_t * node = malloc(sizeof(struct persistent_node_t));
+    struct _persistent_key_t * block = malloc(sizeof(struct _persistent_key_t) + key->len + 1);
+    assert(node != NULL && block != NULL);
+    block->refs = 1;
+    memcpy(block->str, key->str, key->len + 1);
+    node->prefix = key->prefix;
+    node->left = node->right = NULL;
+    node->key = block->str;
+    node->len = key->len;
+    node->height = 0;
+    node->val = value;
+    node->refs = 1;
+    return node;
+}
+
+/** Drops one reference; the last one frees the node and releases its children */
+static void _persistent_release(struct persistent_node_t * node) {
+    while (node != NULL && _PERSISTENT_UNREF(node)) {
+        struct _persistent_key_t * block = _PERSISTENT_KEY(node);
+        if (_PERSISTENT_UNREF(block)) free(block);
+        struct persistent_node_t * right = node->right;
+        _persistent_release(node->left);
+        free(node);
+        node = right;  // loop instead of a second recursion
+    }
+}
+
+/**
+ * Returns a node the writer may modify in place: node itself when nothing else refers to it,
+ * otherwise a copy that takes over the caller's reference. NULL stays NULL.
+ */
+static struct persistent_node_t * _persistent_own(struct persistent_node_t * node) {
+    if (node == NULL || __atomic_load_n(&node->refs, __ATOMIC_ACQUIRE) == 1) return node;
+    struct persistent_node_t * copy = malloc(sizeof(struct persistent_node_t));
+    assert(copy != NULL);
+    *copy = *node;
+    copy->refs = 1;
+    if (copy->left) _PERSISTENT_REF(copy->left);
+    if (copy->right) _PERSISTENT_REF(copy->right);
+    _PERSISTENT_REF(_PERSISTENT_KEY(copy));
+    _persistent_release(node);
+    return copy;
+}
+
+/*
+ * The AVL routines below are those of dict.c, restricted to owned nodes: every node they
+ * modify has been passed through _persistent_own() on the way down.
+ */
+
+#define _PERSISTENT_HEIGHT(tree) ((tree) ? (tree)->height : -1)
+
+inline static void _persistent_update_height(struct persistent_node_t * tree) {
+    int left_height = _PERSISTENT_HEIGHT(tree->left);
+    int right_height = _PERSISTENT_HEIGHT(tree->right);
+    tree->height = (left_height > right_height ? left_height : right_height) + 1;
+}
+
+inline static struct persistent_node_t * _persistent_left_rotate(struct persistent_node_t * tree) {
+    struct persistent_node_t * rotated = tree->right;
+    tree->right = rotated->left;
+    _persistent_update_height(tree);
+    rotated->left = tree;
+    _persistent_update_height(rotated);
+    return rotated;
+}
+
+inline static struct persistent_node_t * _persistent_right_rotate(struct persistent_node_t * tree) {
+    struct persistent_node_t * rotated = tree->left;
+    tree->left = rotated->right;
+    _persistent_update_height(tree);
+    rotated->right = tree;
+    _persistent_update_height(rotated);
+    return rotated;
+}
+
+/** tree is owned; the children a rotation moves are owned here first */
+static struct persistent_node_t * _persistent_maintain(struct persistent_node_t * tree) {
+    _persistent_update_height(tree);
+    struct persistent_node_t * left = tree->left, * right = tree->right;
+    if (_PERSISTENT_HEIGHT(left) > _PERSISTENT_HEIGHT(right) + 1) {
+        left = tree->left = _persistent_own(left);
+        if (_PERSISTENT_HEIGHT(left->left) < _PERSISTENT_HEIGHT(left->right)) {
+            left->right = _persistent_own(left->right);
+            tree->left = _persistent_left_rotate(left);
+        }
+        return _persistent_right_rotate(tree);
+    } else if (_PERSISTENT_HEIGHT(left) + 1 < _PERSISTENT_HEIGHT(right)) {
+        right = tree->right = _persistent_own(right);
+        if (_PERSISTENT_HEIGHT(right->right) < _PERSISTENT_HEIGHT(right->left)) {
+            right->left = _persistent_own(right->left);
+            tree->right = _persistent_right_rotate(right);
+        }
+        return _persistent_left_rotate(tree);
+    } else {
+        return tree;
+    }
+}
+
+static struct persistent_node_t * _persistent_find(struct persistent_node_t * tree, const struct _dict_key_t * key) {
+    while (tree != NULL) {
+        int cmp = _key_cmp(key, tree);
+        if (cmp == 0) break;
+        tree = cmp < 0 ? tree->left : tree->right;
+    }
+    return tree;
+}
+
+/** tree is owned; copies the search path and links a new node, or sets the value of key */
+static struct persistent_node_t * _persistent_insert(struct persistent_node_t * tree, const struct _dict_key_t * key,
+                                                     T value, struct persistent_node_t ** found, unsigned * size) {
+    if (tree == NULL) {
+        ++(*size);
+        return *found = _create_persistent_node(key, value);
+    }
+    unsigned old_size = *size;
+    int cmp = _key_cmp(key, tree);
+    if (cmp < 0) {
+        tree->left = _persistent_insert(_persistent_own(tree->left), key, value, found, size);
+    } else if (cmp > 0) {
+        tree->right = _persistent_insert(_persistent_own(tree->right), key, value, found, size);
+    } else {
+        tree->val = value;
+        *found = tree;
+    }
+    return *size == old_size ? tree : _persistent_maintain(tree);
+}
+
+/** tree is owned; the unlinked minimum (owned as well) goes to *min */
+static struct persistent_node_t * _persistent_exclude_min(struct persistent_node_t * tree,
+                                                          struct persistent_node_t ** min) {
+    if (tree->left == NULL) {
+        *min = tree;
+        struct persistent_node_t * right = tree->right;
+        tree->right = NULL;
+        return right;
+    }
+    tree->left = _persistent_exclude_min(_persistent_own(tree->left), min);
+    return _persistent_maintain(tree);
+}
+
+/** tree is owned and contains key */
+static struct persistent_node_t * _persistent_delete(struct persistent_node_t * tree, const struct _dict_key_t * key) {
+    int cmp = _key_cmp(key, tree);
+    if (cmp < 0) {
+        tree->left = _persistent_delete(_persistent_own(tree->left), key);
+        return _persistent_maintain(tree);
+    } else if (cmp > 0) {
+        tree->right = _persistent_delete(_persistent_own(tree->right), key);
+        return _persistent_maintain(tree);
+    }
+    struct persistent_node_t * current = tree;
+    if (current->right == NULL) {
+        tree = current->left;
+    } else if (current->left == NULL) {
+        tree = current->right;
+    } else {
+        current->right = _persistent_exclude_min(_persistent_own(current->right), &tree);
+        tree->right = current->right;
+        tree->left = current->left;
+        tree = _persistent_maintain(tree);
+    }
+    // the references to the children moved to the replacement
+    current->left = current->right = NULL;
+    _persistent_release(current);
+    return tree;
+}
+
+persistent_dict_t create_persistent_dict(void) {
+    persistent_dict_t dict;
+    dict.root = NULL;
+    dict.size = 0;
+    return dict;
+}
+
+/** O(1); must not run concurrently with an update of dict */
+persistent_dict_t persistent_dict_snapshot(const persistent_dict_t * dict) {
+    assert(dict != NULL);
+    if (dict->root != NULL) _PERSISTENT_REF(dict->root);
+    return *dict;
+}
+
+/** Releases this version only: nodes still shared with other versions stay alive */
+void clear_persistent_dict(persistent_dict_t * dict) {
+    assert(dict != NULL);
+    _persistent_release(dict->root);
+    dict->root = NULL;
+    dict->size = 0;
+}
+
+/** Returns the new node, or NULL without copying anything if key already exists */
+struct persistent_node_t * persistent_dict_add(persistent_dict_t * dict, const char * key, T value) {
+    assert(dict != NULL && key != NULL);
+    struct _dict_key_t k = _dict_key(key);
+    if (_persistent_find(dict->root, &k) != NULL) return NULL;
+    struct persistent_node_t * found = NULL;
+    dict->root = _persistent_insert(_persistent_own(dict->root), &k, value, &found, &dict->size);
+    return found;
+}
+
+struct persistent_node_t * persistent_dict_get(persistent_dict_t dict, const char * key) {
+    assert(key != NULL);
+    struct _dict_key_t k = _dict_key(key);
+    return _persistent_find(dict.root, &k);
+}
+
+/** Inserts key if it is absent */
+void persistent_dict_set(persistent_dict_t * dict, const char * key, T value) {
+    assert(dict != NULL && key != NULL);
+    struct _dict_key_t k = _dict_key(key);
+    struct persistent_node_t * found = NULL;
+    dict->root = _persistent_insert(_persistent_own(dict->root), &k, value, &found, &dict->size);
+}
+
+void persistent_dict_delete(persistent_dict_t * dict, const char * key) {
+    assert(dict != NULL && key != NULL);
+    struct _dict_key_t k = _dict_key(key);
+    assert(_persistent_find(dict->root, &k) != NULL);
+    dict->root = _persistent_delete(_persistent_own(dict->root), &k);
+    dict->size--;
+}
+
+#define _PERSISTENT_ITER_CURRENT(iter) ((iter)->depth > 0 ? (iter)->path[(iter)->depth - 1] : NULL)
+
+static struct persistent_node_t * _persistent_iter_descend(struct persistent_dict_iter_t * iter,
+                                                           struct persistent_node_t * node) {
+    while (node != NULL) {
+        iter->path[iter->depth++] = node;
+        node = node->left;
+    }
+    return _PERSISTENT_ITER_CURRENT(iter);
+}
+
+/** The cursor stays valid while dict is not updated; iterate over a snapshot otherwise */
+struct persistent_node_t * persistent_dict_iter_first(persistent_dict_t * dict, struct persistent_dict_iter_t * iter) {
+    assert(dict != NULL && iter != NULL);
+    iter->depth = 0;
+    return _persistent_iter_descend(iter, dict->root);
+}
+
+struct persistent_node_t * persistent_dict_iter_next(struct persistent_dict_iter_t * iter) {
+    assert(iter != NULL);
+    if (iter->depth == 0) return NULL;
+    struct persistent_node_t * current = iter->path[iter->depth - 1];
+    if (current->right != NULL) return _persistent_iter_descend(iter, current->right);
+    struct persistent_node_t * child;
+    do {
+        child = iter->path[--iter->depth];
+    } while (iter->depth > 0 && iter->path[iter->depth - 1]->right == child);
+    return _PERSISTENT_ITER_CURRENT(iter);
+}
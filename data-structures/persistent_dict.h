@@ -0,0 +1,49 @@
+#ifndef PERSISTENT_DICT_H
+#define PERSISTENT_DICT_H
+
+#include <stdint.h>
+#include "dict.h"
+
+/**
+ * Node of a path-copying AVL tree, shared by every version that can reach it
+ * A node is only modified in place while exactly one reference to it exists.
+ */
+struct persistent_node_t {
+    uint64_t prefix;  // first 8 key bytes, big-endian, zero padded
+    struct persistent_node_t * left, * right;
+    char * key;  // in a reference-counted block shared by all copies of this node
+    unsigned len;
+    int height;
+    T val;
+    unsigned refs;  // versions and parent nodes pointing here
+};
+
+/**
+ * One version of a persistent dict
+ * Taking a snapshot is O(1); updates then copy only the O(log n) nodes on their path that
+ * the snapshot shares. Snapshots have to be taken by the writer (or under its lock), but
+ * can be read and cleared from any thread; the last holder of a node frees it.
+ */
+typedef struct persistent_dict_t {
+    struct persistent_node_t * root;
+    unsigned size;
+} persistent_dict_t;
+
+persistent_dict_t create_persistent_dict(void);
+persistent_dict_t persistent_dict_snapshot(const persistent_dict_t * dict);
+void clear_persistent_dict(persistent_dict_t * dict);
+struct persistent_node_t * persistent_dict_add(persistent_dict_t * dict, const char * key, T value);
+struct persistent_node_t * persistent_dict_get(persistent_dict_t dict, const char * key);
+void persistent_dict_set(persistent_dict_t * dict, const char * key, T value);
+void persistent_dict_delete(persistent_dict_t * dict, const char * key);
+
+/** In-order cursor over one version; see struct dict_iter_t */
+struct persistent_dict_iter_t {
+    struct persistent_node_t * path[DICT_MAX_HEIGHT];
+    int depth;
+};
+
+struct persistent_node_t * persistent_dict_iter_first(persistent_dict_t * dict, struct persistent_dict_iter_t * iter);
+struct persistent_node_t * persistent_dict_iter_next(struct persistent_dict_iter_t * iter);
+
+#endif
@@ -0,0 +1,153 @@
+#include <assert.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+struct pool_slab_t {
+    struct pool_slab_t * next;
+    alignas(max_align_t) char data[];
+};
+
+#define _POOL_ALIGN(n) (((n) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1))
+
+struct pool_t create_pool(size_t obj_size) {
+    assert(obj_size > 0);
+    struct pool_t pool;
+    // a freed object has to be able to hold the free-list link
+    pool.obj_size = _POOL_ALIGN(obj_size < sizeof(void *) ? sizeof(void *) : obj_size);
+    pool.slabs = NULL;
+    pool.free_list = NULL;
+    memset(pool.byte_free_lists, 0, sizeof(pool.byte_free_lists));
+    pool.cursor = pool.end = NULL;
+    return pool;
+}
+
+/** Pushes a new slab with at least `bytes` of payload and makes it the bump target */
+static void _pool_grow(struct pool_t * pool, size_t bytes) {
+    size_t payload = bytes > POOL_SLAB_SIZE ? bytes : POOL_SLAB_SIZE;
+    struct pool_slab_t * slab = malloc(sizeof(struct pool_slab_t) + payload);
+    assert(slab != NULL);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->cursor = slab->data;
+    pool->end = slab->data + payload;
+}
+
+void * pool_alloc(struct pool_t * pool) {
+    assert(pool != NULL && pool->obj_size > 0);
+    if (pool->free_list != NULL) {
+        void * obj = pool->free_list;
+        pool->free_list = *(void **)obj;
+        return obj;
+    }
+    uintptr_t aligned = _POOL_ALIGN((uintptr_t)pool->cursor);
+    if (pool->cursor == NULL || aligned + pool->obj_size > (uintptr_t)pool->end) {
+        _pool_grow(pool, pool->obj_size);
+        aligned = (uintptr_t)pool->cursor;
+    }
+    pool->cursor = (char *)(aligned + pool->obj_size);
+    return (void *)aligned;
+}
+
+/** obj must come from pool_alloc() of the same pool */
+void pool_free(struct pool_t * pool, void * obj) {
+    assert(pool != NULL && obj != NULL);
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+}
+
+/** Size class of a block holding len bytes: class i holds 16 << i */
+static unsigned _pool_byte_class(size_t len) {
+    unsigned i = 0;
+    while (((size_t)16 << i) < len) ++i;
+    assert(i < POOL_BYTE_CLASSES);
+    return i;
+}
+
+/** The copy lives in a block of the next power of two, which pool_strfree() gives back */
+char * pool_strdup(struct pool_t * pool, const char * str) {
+    assert(pool != NULL && str != NULL);
+    size_t len = strlen(str) + 1;
+    unsigned i = _pool_byte_class(len);
+    size_t block = (size_t)16 << i;
+    char * copy = pool->byte_free_lists[i];
+    if (copy != NULL) {
+        pool->byte_free_lists[i] = *(void **)copy;
+    } else if (block > POOL_SLAB_SIZE) {  // its own slab, leaving the bump target alone
+        struct pool_slab_t * slab = malloc(sizeof(struct pool_slab_t) + block);
+        assert(slab != NULL);
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        copy = slab->data;
+    } else {
+        uintptr_t aligned = _POOL_ALIGN((uintptr_t)pool->cursor);
+        if (pool->cursor == NULL || aligned + block > (uintptr_t)pool->end) {
+            _pool_grow(pool, block);
+            aligned = (uintptr_t)pool->cursor;
+        }
+        copy = (char *)aligned;
+        pool->cursor = copy + block;
+    }
+    memcpy(copy, str, len);
+    return copy;
+}
+
+/** str must come from pool_strdup() of the same pool, and still hold the copied string */
+void pool_strfree(struct pool_t * pool, char * str) {
+    assert(pool != NULL && str != NULL);
+    unsigned i = _pool_byte_class(strlen(str) + 1);
+    *(void **)str = pool->byte_free_lists[i];
+    pool->byte_free_lists[i] = str;
+}
+
+/**
+ * Hands all memory of src over to dst, in O(#slabs + #free objects and blocks of src)
+ * Objects of src may then be released into dst. src is left empty but usable.
+ */
+void pool_merge(struct pool_t * dst, struct pool_t * src) {
+    assert(dst != NULL && src != NULL && dst->obj_size == src->obj_size);
+    if (src->slabs != NULL) {
+        struct pool_slab_t * tail = src->slabs;
+        while (tail->next != NULL) tail = tail->next;
+        tail->next = dst->slabs;
+        dst->slabs = src->slabs;
+    }
+    if (src->free_list != NULL) {
+        void ** tail = src->free_list;
+        while (*tail != NULL) tail = *tail;
+        *tail = dst->free_list;
+        dst->free_list = src->free_list;
+    }
+    for (unsigned i = 0; i < POOL_BYTE_CLASSES; ++i) {
+        if (src->byte_free_lists[i] == NULL) continue;
+        void ** tail = src->byte_free_lists[i];
+        while (*tail != NULL) tail = *tail;
+        *tail = dst->byte_free_lists[i];
+        dst->byte_free_lists[i] = src->byte_free_lists[i];
+        src->byte_free_lists[i] = NULL;
+    }
+    if (dst->cursor == NULL) {  // dst had no slab to bump from yet
+        dst->cursor = src->cursor;
+        dst->end = src->end;
+    }
+    src->slabs = NULL;
+    src->free_list = NULL;
+    src->cursor = src->end = NULL;
+}
+
+/** Releases every slab at once; the pool stays usable afterwards */
+void pool_clear(struct pool_t * pool) {
+    assert(pool != NULL);
+    struct pool_slab_t * slab = pool->slabs;
+    while (slab != NULL) {
+        struct pool_slab_t * next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    memset(pool->byte_free_lists, 0, sizeof(pool->byte_free_lists));
+    pool->cursor = pool->end = NULL;
+}
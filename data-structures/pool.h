@@ -0,0 +1,32 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#define POOL_SLAB_SIZE (64 * 1024)
+#define POOL_BYTE_CLASSES 28  // byte blocks of 16, 32, 64, ... 2^31 bytes
+
+struct pool_slab_t;
+
+/**
+ * Slab allocator for fixed-size objects, plus power-of-two blocks for variable-sized bytes
+ * Released objects and blocks go on free-lists (one per block size) and get reused by later
+ * allocations. Memory is only returned to the system by pool_clear(), one free() per slab.
+ */
+struct pool_t {
+    size_t obj_size;  // 0 means the pool is not in use
+    struct pool_slab_t * slabs;
+    void * free_list;
+    void * byte_free_lists[POOL_BYTE_CLASSES];
+    char * cursor, * end;  // unused space in the newest slab
+};
+
+struct pool_t create_pool(size_t obj_size);
+void * pool_alloc(struct pool_t * pool);
+void pool_free(struct pool_t * pool, void * obj);
+char * pool_strdup(struct pool_t * pool, const char * str);
+void pool_strfree(struct pool_t * pool, char * str);
+void pool_merge(struct pool_t * dst, struct pool_t * src);
+void pool_clear(struct pool_t * pool);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/*
+ * Compiling everything with -DDS_STATS counts what the trees and arrays do, for export to
+ * monitoring: dict_stats() for all dicts, avl_stats() for all trees of USE_AVL_NAMED and
+ * array_stats() for all arrays. Without it the counters and these functions compile to nothing.
+ * Counters only grow, and are kept per kind of structure rather than per instance, so node
+ * and array layouts are the same either way. Each kind has one set, defined in dict.c, avl.c
+ * or array.c, that code generated in any source file counts into. They are updated with plain
+ * relaxed loads and stores instead of atomic increments, to stay cheap: structures modified
+ * from several threads at once may lose some counts.
+ */
+
+struct avl_stats_t {
+    uint64_t lookups;
+    uint64_t compares;   // made by lookups, so compares / lookups is their average depth
+    uint64_t max_depth;  // deepest a lookup went, the root being at depth 1
+    uint64_t rotations;
+    uint64_t maintains;  // rebalancing checks, one per node on a modified path
+    uint64_t allocations;
+    uint64_t bytes_allocated;  // by node allocations, including out-of-node keys
+};
+
+struct array_stats_t {
+    uint64_t appends;  // append() calls
+    uint64_t pops;
+    uint64_t reallocs;  // growing, shrinking and file remaps
+    uint64_t bytes_allocated;  // sizes of all the blocks obtained, in bytes
+};
+
+#ifdef DS_STATS
+#define _STATS_LOAD(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#define _STATS_ADD(counter, n) __atomic_store_n(&(counter), _STATS_LOAD(counter) + (n), __ATOMIC_RELAXED)
+#define _STATS_MAX(counter, n) do {                                              \
+    uint64_t _value = (n);                                                      \
+    if (_value > _STATS_LOAD(counter)) __atomic_store_n(&(counter), _value, __ATOMIC_RELAXED); \
+} while (0)
+
+/** Adds one lookup that compared its key depth times */
+#define _STATS_LOOKUP(stats, depth) do {                                         \
+    _STATS_ADD((stats).lookups, 1);                                             \
+    _STATS_ADD((stats).compares, (depth));                                      \
+    _STATS_MAX((stats).max_depth, (depth));                                     \
+} while (0)
+
+inline static struct avl_stats_t _avl_stats_read(const struct avl_stats_t * stats) {
+    struct avl_stats_t copy;
+    copy.lookups = _STATS_LOAD(stats->lookups);
+    copy.compares = _STATS_LOAD(stats->compares);
+    copy.max_depth = _STATS_LOAD(stats->max_depth);
+    copy.rotations = _STATS_LOAD(stats->rotations);
+    copy.maintains = _STATS_LOAD(stats->maintains);
+    copy.allocations = _STATS_LOAD(stats->allocations);
+    copy.bytes_allocated = _STATS_LOAD(stats->bytes_allocated);
+    return copy;
+}
+
+inline static struct array_stats_t _array_stats_read(const struct array_stats_t * stats) {
+    struct array_stats_t copy;
+    copy.appends = _STATS_LOAD(stats->appends);
+    copy.pops = _STATS_LOAD(stats->pops);
+    copy.reallocs = _STATS_LOAD(stats->reallocs);
+    copy.bytes_allocated = _STATS_LOAD(stats->bytes_allocated);
+    return copy;
+}
+#else
+#define _STATS_ADD(counter, n) ((void)0)
+#define _STATS_MAX(counter, n) ((void)0)
+#define _STATS_LOOKUP(stats, depth) ((void)(depth))
+#endif
+
+#endif
@@ -0,0 +1,98 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "thread_pool.h"
+
+enum { _TASK_QUEUED, _TASK_RUNNING, _TASK_DONE };
+
+static void * _thread_pool_worker(void * arg) {
+    struct thread_pool_t * pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->length == 0 && !pool->stopping) pthread_cond_wait(&pool->has_work, &pool->lock);
+        if (pool->length == 0) break;
+        // oldest first: those are the biggest pieces of a recursive split
+        struct task_t * task = pool->queue[0];
+        for (unsigned i = 1; i < pool->length; ++i) pool->queue[i - 1] = pool->queue[i];
+        pool->length--;
+        task->state = _TASK_RUNNING;
+        pthread_mutex_unlock(&pool->lock);
+        task->run(task->arg);
+        pthread_mutex_lock(&pool->lock);
+        task->state = _TASK_DONE;
+        pthread_cond_broadcast(&pool->has_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/** threads == 0 gives a pool that runs every task on the joining thread */
+struct thread_pool_t * create_thread_pool(unsigned threads) {
+    struct thread_pool_t * pool = malloc(sizeof(struct thread_pool_t));
+    assert(pool != NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->has_work, NULL);
+    pthread_cond_init(&pool->has_done, NULL);
+    pool->length = 0;
+    pool->capacity = 64;
+    pool->queue = malloc(sizeof(struct task_t *) * pool->capacity);
+    pool->workers = malloc(sizeof(pthread_t) * (threads + 1));
+    assert(pool->queue != NULL && pool->workers != NULL);
+    pool->threads = threads;
+    pool->stopping = 0;
+    for (unsigned i = 0; i < threads; ++i) {
+        int err = pthread_create(pool->workers + i, NULL, _thread_pool_worker, pool);
+        assert(err == 0);
+        (void)err;
+    }
+    return pool;
+}
+
+/** Waits for queued tasks to finish */
+void destroy_thread_pool(struct thread_pool_t * pool) {
+    assert(pool != NULL);
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->has_work);
+    pthread_mutex_unlock(&pool->lock);
+    for (unsigned i = 0; i < pool->threads; ++i) pthread_join(pool->workers[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->has_work);
+    pthread_cond_destroy(&pool->has_done);
+    free(pool->queue);
+    free(pool->workers);
+    free(pool);
+}
+
+/** task->run and task->arg must be set; task must stay alive until joined */
+void thread_pool_fork(struct thread_pool_t * pool, struct task_t * task) {
+    assert(pool != NULL && task != NULL);
+    pthread_mutex_lock(&pool->lock);
+    if (pool->length == pool->capacity) {
+        pool->capacity *= 2;
+        pool->queue = realloc(pool->queue, sizeof(struct task_t *) * pool->capacity);
+        assert(pool->queue != NULL);
+    }
+    task->state = _TASK_QUEUED;
+    pool->queue[pool->length++] = task;
+    pthread_cond_signal(&pool->has_work);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_join(struct thread_pool_t * pool, struct task_t * task) {
+    assert(pool != NULL && task != NULL);
+    pthread_mutex_lock(&pool->lock);
+    if (task->state == _TASK_QUEUED) {
+        // nobody took it: unqueue it and run it here
+        unsigned i = pool->length;
+        while (pool->queue[--i] != task) {}
+        for (; i + 1 < pool->length; ++i) pool->queue[i] = pool->queue[i + 1];
+        pool->length--;
+        task->state = _TASK_RUNNING;
+        pthread_mutex_unlock(&pool->lock);
+        task->run(task->arg);
+        task->state = _TASK_DONE;
+        return;
+    }
+    while (task->state != _TASK_DONE) pthread_cond_wait(&pool->has_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
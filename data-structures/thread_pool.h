@@ -0,0 +1,35 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+
+/**
+ * A unit of fork-join work; lives on the forking thread's stack until joined
+ */
+struct task_t {
+    void (*run)(void * arg);
+    void * arg;
+    int state;
+};
+
+/**
+ * Fixed set of workers fed from one shared queue
+ * A joined task that no worker has picked up yet is taken back and run by the joining thread,
+ * so nested fork/join never deadlocks and never needs more threads than it was given.
+ */
+struct thread_pool_t {
+    pthread_mutex_t lock;
+    pthread_cond_t has_work, has_done;
+    struct task_t ** queue;
+    unsigned length, capacity;
+    pthread_t * workers;
+    unsigned threads;
+    int stopping;
+};
+
+struct thread_pool_t * create_thread_pool(unsigned threads);
+void destroy_thread_pool(struct thread_pool_t * pool);
+void thread_pool_fork(struct thread_pool_t * pool, struct task_t * task);
+void thread_pool_join(struct thread_pool_t * pool, struct task_t * task);
+
+#endif
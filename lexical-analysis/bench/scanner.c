@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "scanner.h"  // written by c_scanner.py
+
+/*
+ * scanner FILE: throughput of the generated scanner over FILE, whole and in 64 KiB chunks
+ * scanner FILE MODE: prints "token length" for every token, scanning FILE whole (MODE "whole"),
+ * in chunks of MODE bytes, or in chunks of random sizes (MODE "random")
+ */
+#define CHUNK (64 << 10)
+#define ROUNDS 5
+
+struct tokens_t {
+    const char * input;  // tokens must be contiguous copies of the input
+    size_t offset;
+    unsigned long count;
+    int print;
+};
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void on_token(int token, const char * text, size_t len, void * ctx) {
+    struct tokens_t * tokens = ctx;
+    if (tokens->print) {
+        if (memcmp(text, tokens->input + tokens->offset, len) != 0) {
+            fprintf(stderr, "token at %zu has the wrong text\n", tokens->offset);
+            exit(1);
+        }
+        printf("%d %zu\n", token, len);
+    }
+    tokens->offset += len;
+    tokens->count++;
+}
+
+static char * read_file(const char * path, size_t * size) {
+    FILE * f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char * data = malloc(*size + 1);
+    if (fread(data, 1, *size, f) != *size) {
+        perror(path);
+        exit(1);
+    }
+    fclose(f);
+    return data;
+}
+
+static void scan_chunked(const char * data, size_t size, size_t chunk, struct tokens_t * tokens) {
+    struct scanner_t scanner = create_scanner();
+    unsigned seed = 1;
+    for (size_t i = 0; i < size;) {
+        size_t n = chunk > 0 ? chunk : (seed = seed * 1103515245 + 12345) % 4096 + 1;
+        if (n > size - i) n = size - i;
+        scanner_feed(&scanner, data + i, n, on_token, tokens);
+        i += n;
+    }
+    scanner_finish(&scanner, on_token, tokens);
+    clear_scanner(&scanner);
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s FILE [whole|CHUNK|random]\n", argv[0]);
+        return 1;
+    }
+    size_t size;
+    char * data = read_file(argv[1], &size);
+    struct tokens_t tokens = {data, 0, 0, argc > 2};
+    if (argc > 2) {
+        if (strcmp(argv[2], "whole") == 0) scanner_scan(data, size, 1, on_token, &tokens);
+        else scan_chunked(data, size, strcmp(argv[2], "random") == 0 ? 0 : strtoul(argv[2], NULL, 10), &tokens);
+        if (tokens.offset != size) {
+            fprintf(stderr, "tokens cover %zu of %zu bytes\n", tokens.offset, size);
+            return 1;
+        }
+        free(data);
+        return 0;
+    }
+
+    printf("mode,bytes,tokens,mb_per_sec\n");
+    double best = 1e30;
+    for (int round = 0; round < ROUNDS; ++round) {
+        tokens.count = 0;
+        double start = now();
+        scanner_scan(data, size, 1, on_token, &tokens);
+        double elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    printf("whole,%zu,%lu,%.1f\n", size, tokens.count, size / best / 1e6);
+    best = 1e30;
+    for (int round = 0; round < ROUNDS; ++round) {
+        tokens.count = 0;
+        double start = now();
+        scan_chunked(data, size, CHUNK, &tokens);
+        double elapsed = now() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    printf("chunked,%zu,%lu,%.1f\n", size, tokens.count, size / best / 1e6);
+    free(data);
+    return 0;
+}
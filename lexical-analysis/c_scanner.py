@@ -0,0 +1,257 @@
+#!/usr/bin/env python3
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+from subset_construction import LazyDFA, int_bytes
+from thompson import TOKEN_RULES, compile_rules, rule_accepting, rules_nfa
+
+C_TYPES = {1: 'int8_t', 2: 'int16_t', 4: 'int32_t'}
+
+
+def _c_array(values, per_line=16, indent='    '):
+    lines = []
+    for i in range(0, len(values), per_line):
+        lines.append(indent + ', '.join(str(v) for v in values[i:i + per_line]) + ',')
+    return '\n'.join(lines)
+
+
+def token_names(accept):
+    """Accept classes in order of first appearance: those of token ids 1, 2, ... in the header"""
+    names = []
+    for tag in accept:
+        if tag is not None and tag not in names:
+            names.append(tag)
+    return names
+
+
+def emit_c_scanner(table, accept, alphabet, prefix='scanner', names=None):
+    """
+    Returns a self-contained C header that tokenizes bytes with the DFA of dense_table()
+    Symbols of the alphabet are single bytes, or lists of bytes sharing a column as returned by
+    byte_classes(); any other byte ends the token being scanned.
+    Accept classes become token ids 1, 2, ... as listed by names, token_names(accept) by default,
+    which the header also holds in <prefix>_token_names.
+    """
+    tokens = token_names(accept) if names is None else list(names)
+    columns = len(alphabet) + 1  # the last column is every byte outside the alphabet
+    column = [len(alphabet)] * 256
+    for j, c in enumerate(alphabet):
+        for member in c if isinstance(c, list) else [c]:
+            column[ord(member)] = j
+    rows = [row + [-1] for row in table] or [[-1] * columns]
+    state_type = C_TYPES[int_bytes([len(rows)])]
+    column_type = 'uint8_t' if columns <= 256 else 'uint16_t'
+    token_type = 'uint8_t' if len(tokens) < 256 else 'uint16_t'
+    accept_ids = [0 if tag is None else tokens.index(tag) + 1 for tag in accept] or [0]
+    names = ', '.join('"%s"' % str(tag).replace('\\', '\\\\').replace('"', '\\"') for tag in tokens)
+    return _C_TEMPLATE.format(
+        p=prefix, P=prefix.upper(), states=len(rows), columns=columns, ntokens=len(tokens),
+        names=names, state_type=state_type, column_type=column_type, token_type=token_type,
+        column=_c_array(column), accept=_c_array(accept_ids),
+        next=',\n'.join('    {' + ', '.join(str(t) for t in row) + '}' for row in rows))
+
+
+_C_TEMPLATE = '''\
+/* Generated by c_scanner.py: a table-driven maximal-munch scanner. Do not edit. */
+#ifndef {P}_H
+#define {P}_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define {P}_STATES {states}
+#define {P}_TOKENS {ntokens}  /* token ids are 1..{P}_TOKENS; 0 is a byte no rule matches */
+
+static const char * const {p}_token_names[] = {{"<error>", {names}}};
+
+static const {column_type} {p}_column[256] = {{
+{column}
+}};
+
+static const {state_type} {p}_next[{states}][{columns}] = {{
+{next}
+}};
+
+static const {token_type} {p}_accept[{states}] = {{
+{accept}
+}};
+
+/* Called once per token, in input order; text is only valid during the call */
+typedef void (*{p}_callback_t)(int token, const char * text, size_t len, void * ctx);
+
+#define _{P}_STEP(state, byte) ({p}_next[(state)][{p}_column[(unsigned char)(byte)]])
+
+/*
+ * Tokenizes text[0, n), longest match first; a byte where no token starts is reported alone as
+ * token 0. Unless final, stops before a token that may continue past n and returns its offset;
+ * returns n once everything was reported.
+ */
+static inline size_t {p}_scan(const char * text, size_t n, int final, {p}_callback_t callback, void * ctx) {{
+    size_t start = 0;
+    while (start < n) {{
+        int state = 0, token = 0;
+        size_t end = start, i = start;
+        while (i < n) {{
+            state = _{P}_STEP(state, text[i]);
+            if (state < 0) break;
+            ++i;
+            if ({p}_accept[state]) {{
+                token = {p}_accept[state];
+                end = i;
+            }}
+        }}
+        if (state >= 0 && !final) return start;
+        if (token == 0) end = start + 1;
+        callback(token, text + start, end - start, ctx);
+        start = end;
+    }}
+    return n;
+}}
+
+/* Scanner over input that arrives in chunks; tokens may straddle chunk boundaries */
+struct {p}_t {{
+    char * carry;  /* bytes of the token still being scanned */
+    size_t len, capacity;
+}};
+
+static inline struct {p}_t create_{p}(void) {{
+    struct {p}_t scanner = {{NULL, 0, 0}};
+    return scanner;
+}}
+
+static inline void _{p}_append(struct {p}_t * scanner, const char * data, size_t n) {{
+    if (scanner->len + n > scanner->capacity) {{
+        scanner->capacity = scanner->capacity * 2 > scanner->len + n ? scanner->capacity * 2 : scanner->len + n;
+        scanner->carry = realloc(scanner->carry, scanner->capacity);
+        assert(scanner->carry != NULL);
+    }}
+    if (n > 0) memcpy(scanner->carry + scanner->len, data, n);
+    scanner->len += n;
+}}
+
+/*
+ * Reports the tokens that start in the carried bytes, taking what they need from data[*pos, n)
+ * and advancing *pos past it; leaves all of data in the carry if it's still not enough
+ */
+static inline void _{p}_drain(struct {p}_t * scanner, const char * data, size_t n, size_t * pos, int final,
+                              {p}_callback_t callback, void * ctx) {{
+    while (scanner->len > 0) {{
+        int state = 0, token = 0;
+        size_t end = 0;
+        for (size_t i = 0; i < scanner->len && state >= 0; ++i) {{
+            state = _{P}_STEP(state, scanner->carry[i]);
+            if (state >= 0 && {p}_accept[state]) {{
+                token = {p}_accept[state];
+                end = i + 1;
+            }}
+        }}
+        if (state >= 0) {{  /* the token goes on into data */
+            size_t j = *pos, old_len = scanner->len;
+            for (; j < n; ++j) {{
+                state = _{P}_STEP(state, data[j]);
+                if (state < 0) break;
+                if ({p}_accept[state]) {{
+                    token = {p}_accept[state];
+                    end = old_len + j - *pos + 1;
+                }}
+            }}
+            _{p}_append(scanner, data + *pos, j - *pos);
+            *pos = j;
+            if (state >= 0 && !final) return;
+        }}
+        size_t used = token == 0 ? 1 : end;
+        callback(token, scanner->carry, used, ctx);
+        memmove(scanner->carry, scanner->carry + used, scanner->len - used);
+        scanner->len -= used;
+    }}
+}}
+
+static inline void {p}_feed(struct {p}_t * scanner, const char * data, size_t n, {p}_callback_t callback,
+                            void * ctx) {{
+    size_t pos = 0;
+    _{p}_drain(scanner, data, n, &pos, 0, callback, ctx);
+    if (scanner->len > 0) return;  /* data only extended the pending token */
+    pos += {p}_scan(data + pos, n - pos, 0, callback, ctx);
+    _{p}_append(scanner, data + pos, n - pos);
+}}
+
+/* Reports what is left at the end of the input; the scanner can then start over */
+static inline void {p}_finish(struct {p}_t * scanner, {p}_callback_t callback, void * ctx) {{
+    size_t pos = 0;
+    _{p}_drain(scanner, NULL, 0, &pos, 1, callback, ctx);
+}}
+
+static inline void clear_{p}(struct {p}_t * scanner) {{
+    free(scanner->carry);
+    *scanner = create_{p}();
+}}
+
+#endif
+'''
+
+
+def source_input(size, seed=1):
+    """C-like source for TOKEN_RULES, with the odd byte no rule matches"""
+    rng = random.Random(seed)
+    lexemes = ['if', 'else', 'while', 'return', 'iffy', 'count', 'x1', '_tmp', 'buffer_size', '0', '42',
+               '3.14', '6.02e23', '"hello"', '"a\\"b"', '+', '-=', '==', '!=', '&&', '||', '(', ')',
+               '{', '}', ';', ',', '@', '#']
+    spaces = [' ', ' ', ' ', '\n', '\n    ', '']
+    words = []
+    length = 0
+    while length < size:
+        word = rng.choice(lexemes) + rng.choice(spaces)
+        words.append(word)
+        length += len(word)
+    return ''.join(words).encode('latin-1')[:size]
+
+
+def main():
+    """Benchmarks the generated scanner for TOKEN_RULES, and checks it against the Python DFA"""
+    megabytes = int(sys.argv[1]) if len(sys.argv) > 1 else 64
+    table, accept, classes, names = compile_rules(TOKEN_RULES)
+    nfa, start, tags = rules_nfa(TOKEN_RULES)
+    here = os.path.dirname(os.path.abspath(__file__))
+    with tempfile.TemporaryDirectory() as tmp:
+        with open(os.path.join(tmp, 'scanner.h'), 'w') as f:
+            f.write(emit_c_scanner(table, accept, classes, names=names))
+        binary = os.path.join(tmp, 'scanner_bench')
+        cflags = os.environ.get('CFLAGS', '-O2').split()
+        subprocess.run([os.environ.get('CC', 'cc')] + cflags + ['-I', tmp, '-o', binary,
+                       os.path.join(here, 'bench', 'scanner.c')], check=True)
+
+        sample = source_input(1 << 20)
+        sample_path = os.path.join(tmp, 'sample.txt')
+        with open(sample_path, 'wb') as f:
+            f.write(sample)
+        t = time.time()
+        lazy = LazyDFA(nfa, start, classes, rule_accepting(tags), max_states=len(table) // 2)
+        expected = [(0 if tag is None else names.index(tag) + 1, end - begin)
+                    for tag, begin, end in lazy.tokens(sample.decode('latin-1'))]
+        python_seconds = time.time() - t
+        for mode in ('whole', '1', '7', '4096', 'random'):
+            out = subprocess.run([binary, sample_path, mode], check=True, stdout=subprocess.PIPE).stdout
+            got = [tuple(int(x) for x in line.split()) for line in out.decode().splitlines()]
+            if got != expected:
+                first = next(i for i in range(min(len(got), len(expected)) + 1)
+                             if i >= min(len(got), len(expected)) or got[i] != expected[i])
+                sys.exit('chunks of %s: token %d differs from the Python DFA' % (mode, first))
+        print('%d rules: %d byte classes, %d states' % (len(names), len(classes), len(table)))
+        print('%d tokens match the lazy Python DFA (%.2f MB/s, %d cache flushes) in every chunking' % (
+            len(expected), 1 / python_seconds, lazy.flushes))
+
+        data_path = os.path.join(tmp, 'data.txt')
+        with open(data_path, 'wb') as f:
+            for _ in range(megabytes):
+                f.write(sample)
+        subprocess.run([binary, data_path], check=True)
+
+
+if __name__ == '__main__':
+    main()
@@ -3,57 +3,298 @@ import networkx as nx
 from collections import deque
 
 
+def epsilon_closures(nfa):
+    """Maps every NFA state to the frozenset of states reachable from it by epsilon edges"""
+    epsilon = {s: [v for v, attr in nfa[s].items() if attr['e'] == ''] for s in nfa}
+    closures = {}
+    for s in nfa:
+        closure = {s}
+        stack = [s]
+        while stack:
+            for neighbor in epsilon[stack.pop()]:
+                if neighbor not in closure:
+                    closure.add(neighbor)
+                    stack.append(neighbor)
+        closures[s] = frozenset(closure)
+    return closures
+
+
+def edge_symbols(label):
+    """Symbols an edge matches: its label is '' (epsilon), one symbol, or a frozenset of symbols"""
+    return label if isinstance(label, frozenset) else () if label == '' else (label,)
+
+
+def transition_index(nfa, alphabet):
+    """Maps every symbol to {state: successors on that symbol}, leaving out states without any"""
+    index = {c: {} for c in alphabet}
+    for u, v, label in nfa.edges(data='e'):
+        for c in edge_symbols(label):
+            if c in index:
+                index[c].setdefault(u, []).append(v)
+    return index
+
+
+def byte_classes(nfa, alphabet):
+    """
+    Partitions the alphabet into lists of symbols that every NFA state treats alike, in order of
+    first appearance; symbols on no edge at all share a class. Running subset_construction() on
+    one representative per class gives the same DFA with one column per class.
+    """
+    index = transition_index(nfa, alphabet)
+    classes = {}
+    for c in alphabet:
+        signature = frozenset((u, frozenset(vs)) for u, vs in index[c].items())
+        classes.setdefault(signature, []).append(c)
+    return list(classes.values())
+
+
 def subset_construction(nfa, start, alphabet):
-    def state_epsilon_closure(s, know_closure=None):
-        if s in nfa.nodes[s]:
-            return nfa.nodes[s]['closure']
-        closure = know_closure if know_closure else set()
-        closure.update([s])
-        for neighbor, attr in nfa[s].items():
-            if neighbor not in closure and attr['e'] == '':
-                closure.update(state_epsilon_closure(neighbor, closure))
-        if know_closure is None:
-            nfa.nodes[s]['closure'] = closure
-        return closure
-
-    def states_epsilon_closure(s):
-        s = tuple(s)
-        if s in nfa.graph:
-            return nfa.graph[s]
-        closure = set()
-        for e in s:
-            closure.update(state_epsilon_closure(e))
-        nfa.graph[s] = closure
-        return closure
-
-    def move(s, c):
-        reachable = set()
-        for e in s:
-            for neighbor, attr in nfa[e].items():
-                if attr['e'] == c:
-                    reachable.add(neighbor)
-        return reachable
-
-    mark = set()
+    """
+    Returns the DFA as {state: {symbol: state}}, states in order of discovery, the start first
+    DFA states are frozensets of NFA states, whatever order their members were found in.
+    Equal subsets share one object, whose hash is computed once and cached by frozenset.
+    """
+    closures = epsilon_closures(nfa)
+    index = transition_index(nfa, alphabet)
+    states = {}  # hash-consing: every subset found so far, mapped to itself
+    closure_of = {}  # move() results seen so far, mapped to their closures
+    states_queue = deque()
+
+    def intern(subset):
+        if subset not in states:
+            states[subset] = subset
+            states_queue.append(subset)
+        return states[subset]
+
+    def states_epsilon_closure(moved):
+        if moved not in closure_of:
+            closure_of[moved] = intern(frozenset().union(*(closures[s] for s in moved)))
+        return closure_of[moved]
+
+    def move(t, c):
+        successors = index[c]
+        return frozenset(v for s in t if s in successors for v in successors[s])
+
     d_trans = {}
-    states_queue = deque([tuple(state_epsilon_closure(start))])
+    intern(closures[start])
     while len(states_queue) > 0:
         t = states_queue.popleft()
-        if t in mark:
-            continue
-        mark.add(t)
-        for c in alphabet:
-            u = tuple(states_epsilon_closure(move(t, c)))
-            if u not in mark:
-                states_queue.append(u)
-            if t in d_trans:
-                d_trans[t][c] = u
-            else:
-                d_trans[t] = {c: u}
+        d_trans[t] = {c: states_epsilon_closure(move(t, c)) for c in alphabet}
     return d_trans
 
 
-def main():
+class LazyDFA:
+    """
+    Determinizes the NFA while scanning, only for the states and symbols the input reaches
+    Found states, their transitions and accept classes are cached; once max_states are cached,
+    the cache is flushed and refilled from the state being left, so memory stays bounded however
+    large the full DFA is. States are frozensets of NFA states, as in subset_construction(), and
+    the empty set is the dead state. alphabet may be byte_classes(), in which case transitions
+    are computed and cached per class.
+    """
+
+    def __init__(self, nfa, start, alphabet, accepting, max_states=10000):
+        classes = [c if isinstance(c, list) else [c] for c in alphabet]
+        self.class_of = {c: i for i, members in enumerate(classes) for c in members}
+        self.representatives = [members[0] for members in classes]
+        self.index = transition_index(nfa, self.representatives)
+        self.closures = epsilon_closures(nfa)
+        self.accepting = accepting
+        self.max_states = max(2, max_states)
+        self.start = self.closures[start]
+        self.dead = frozenset()
+        self.rows = {}  # state: [successor per class, None until needed]
+        self.tags = {}  # state: accept class
+        self.flushes = 0
+        self._add(self.start)
+
+    def _add(self, state, keep=None):
+        """Caches state, first flushing the cache if full; keep is cached again after a flush"""
+        if len(self.rows) >= self.max_states:
+            self.flushes += 1
+            self.rows.clear()
+            self.tags.clear()
+            if keep is not None:
+                self._add(keep)
+        self.rows[state] = [None] * len(self.representatives)
+        self.tags[state] = self.accepting(state)
+
+    def step(self, state, c):
+        """The state after state reads c; symbols outside the alphabet lead to the dead state"""
+        i = self.class_of.get(c)
+        if i is None:
+            return self.dead
+        row = self.rows.get(state)
+        if row is None:
+            self._add(state)
+            row = self.rows[state]
+        successor = row[i]
+        if successor is None:
+            successors = self.index[self.representatives[i]]
+            moved = {v for s in state if s in successors for v in successors[s]}
+            successor = frozenset().union(*(self.closures[s] for s in moved))
+            if successor not in self.rows:
+                self._add(successor, keep=state)
+                row = self.rows[state]
+            row[i] = successor
+        return successor
+
+    def tag(self, state):
+        """Accept class of a state reached by step()"""
+        if state not in self.tags:
+            self._add(state)
+        return self.tags[state]
+
+    def longest_match(self, text, pos=0):
+        """(accept class, end) of the longest match starting at text[pos], or (None, pos)"""
+        state, tag, end = self.start, None, pos
+        for i in range(pos, len(text)):
+            state = self.step(state, text[i])
+            if state == self.dead:
+                break
+            if self.tag(state) is not None:
+                tag, end = self.tag(state), i + 1
+        return tag, end
+
+    def tokens(self, text):
+        """Maximal-munch (accept class, start, end) tokens; None for a symbol no token starts with"""
+        pos = 0
+        while pos < len(text):
+            tag, end = self.longest_match(text, pos)
+            if tag is None:
+                end = pos + 1
+            yield tag, pos, end
+            pos = end
+
+
+def hopcroft_minimize(d_trans, alphabet, accepting):
+    """
+    Returns the blocks of equivalent DFA states, as a list of sets of states
+    accepting(state) gives the accept class of a state, or None if it rejects; states of
+    different classes never share a block, so each rule keeps its own accepting states.
+    """
+    states = list(d_trans)
+    inverse = {c: {} for c in alphabet}  # inverse[c][t]: states that go to t on c
+    for s, trans in d_trans.items():
+        for c in alphabet:
+            inverse[c].setdefault(trans[c], []).append(s)
+    classes = {}
+    for s in states:
+        classes.setdefault(accepting(s), set()).add(s)
+    blocks = list(classes.values())
+    block_of = {s: i for i, block in enumerate(blocks) for s in block}
+    largest = max(range(len(blocks)), key=lambda i: len(blocks[i]))
+    worklist = {i for i in range(len(blocks)) if i != largest}
+    while worklist:
+        splitter = list(blocks[worklist.pop()])  # a copy: the block itself may be split below
+        for c in alphabet:
+            preimage = {s for t in splitter for s in inverse[c].get(t, ())}
+            touched = {}
+            for s in preimage:
+                touched.setdefault(block_of[s], set()).add(s)
+            for i, inside in touched.items():
+                if len(inside) == len(blocks[i]):
+                    continue
+                blocks[i] -= inside
+                blocks.append(inside)
+                j = len(blocks) - 1
+                for s in inside:
+                    block_of[s] = j
+                if i in worklist or len(inside) <= len(blocks[i]):
+                    worklist.add(j)
+                else:
+                    worklist.add(i)
+    return blocks
+
+
+def dense_table(d_trans, alphabet, accepting, blocks=None):
+    """
+    Numbers the DFA states, or its blocks of equivalent states, in breadth-first order from the
+    start (state 0), and returns (table, accept): table[i][j] is the state that state i goes to
+    on alphabet[j], and accept[i] its accept class. A dead state, which rejects and only leads to
+    itself, is left out and all transitions to it become -1.
+    """
+    if blocks is None:
+        blocks = [{s} for s in d_trans]
+    block_of = {s: i for i, block in enumerate(blocks) for s in block}
+    representative = [next(iter(block)) for block in blocks]
+
+    def is_dead(i):
+        s = representative[i]
+        return accepting(s) is None and all(block_of[d_trans[s][c]] == i for c in alphabet)
+
+    number = {}
+    order = deque()
+    start = block_of[next(iter(d_trans))]
+    if not is_dead(start):
+        number[start] = 0
+        order.append(start)
+    table, accept = [], []
+    while order:
+        i = order.popleft()
+        row = []
+        for c in alphabet:
+            j = block_of[d_trans[representative[i]][c]]
+            if j not in number and not is_dead(j):
+                number[j] = len(number)
+                order.append(j)
+            row.append(number.get(j, -1))
+        table.append(row)
+        accept.append(accepting(representative[i]))
+    return table, accept
+
+
+def row_displacement(table):
+    """
+    Packs the rows of a table whose entries are mostly -1 into one pair of arrays:
+    table[i][j] == (next[base[i] + j] if check[base[i] + j] == i else -1)
+    Rows are placed densest first, each at the lowest base where it overlaps no earlier row.
+    """
+    width = len(table[0]) if table else 0
+    base = [0] * len(table)
+    next_, check = [], []
+    first_free = 0  # every slot below is taken
+    for i in sorted(range(len(table)), key=lambda i: -sum(t >= 0 for t in table[i])):
+        columns = [j for j in range(width) if table[i][j] >= 0]
+        if not columns:
+            continue
+        offset = max(0, first_free - columns[0])
+        while any(offset + j < len(check) and check[offset + j] >= 0 for j in columns):
+            offset += 1
+        base[i] = offset
+        grow = offset + columns[-1] + 1 - len(check)
+        if grow > 0:
+            next_.extend([-1] * grow)
+            check.extend([-1] * grow)
+        for j in columns:
+            next_[offset + j] = table[i][j]
+            check[offset + j] = i
+        while first_free < len(check) and check[first_free] >= 0:
+            first_free += 1
+    return base, next_, check
+
+
+def int_bytes(values):
+    """Width of the narrowest signed integer type that holds all values"""
+    largest = max((abs(v) for v in values), default=0)
+    return 1 if largest < 2 ** 7 else 2 if largest < 2 ** 15 else 4
+
+
+def table_size_report(table, accept, compressed=None):
+    """One line: entries and bytes of a dense table, or of its row-displacement form"""
+    if compressed is None:
+        entries = sum(len(row) for row in table)
+        size = entries * int_bytes([len(table)]) + len(accept)
+        return '%d states x %d symbols = %d entries, %d bytes' % (
+            len(table), len(table[0]) if table else 0, entries, size)
+    base, next_, check = compressed
+    size = len(base) * int_bytes([len(next_)]) + len(next_) * 2 * int_bytes([len(table)]) + len(accept)
+    return '%d bases + 2 x %d next/check = %d entries, %d bytes' % (
+        len(base), len(next_), len(base) + 2 * len(next_), size)
+
+
+def demo_nfa():
+    """The NFA of (a|b)*a(a|b)(a|b), as (nfa, start, accepting state)"""
     fsa = nx.DiGraph()
     fsa.add_edge(0, 1, e='')
     fsa.add_edge(0, 3, e='')
@@ -76,8 +317,11 @@ def main():
     fsa.add_edge(14, 15, e='b')
     fsa.add_edge(13, 16, e='')
     fsa.add_edge(15, 16, e='')
-    start = 0
-    ac = 16
+    return fsa, 0, 16
+
+
+def main():
+    fsa, start, ac = demo_nfa()
     dfa = subset_construction(fsa, start, ['a', 'b'])
     mapping = {}
     base = ord('A')
@@ -85,7 +329,28 @@ def main():
         mapping[key] = chr(base)
         base += 1
     for state, trans in dfa.items():
-        print(mapping[state], {key: mapping[val] for key, val in trans.items()}, '.' if ac in state else ' ', state)
+        print(mapping[state], {key: mapping[val] for key, val in trans.items()}, '.' if ac in state else ' ',
+              tuple(sorted(state)))
+
+    def accepting(state):
+        return 'ac' if ac in state else None
+
+    table, accept = dense_table(dfa, ['a', 'b'], accepting)
+    blocks = hopcroft_minimize(dfa, ['a', 'b'], accepting)
+    min_table, min_accept = dense_table(dfa, ['a', 'b'], accepting, blocks)
+    print()
+    for i, (row, tag) in enumerate(zip(min_table, min_accept)):
+        print(i, row, '.' if tag else ' ')
+    print('dense:        ', table_size_report(table, accept))
+    print('minimized:    ', table_size_report(min_table, min_accept))
+    print('row-displaced:', table_size_report(min_table, min_accept, row_displacement(min_table)))
+
+    classes = byte_classes(fsa, [chr(b) for b in range(256)])
+    lazy = LazyDFA(fsa, start, classes, accepting, max_states=4)
+    text = 'abbab aabba babba'
+    print('byte classes: ', len(classes), 'of 256')
+    print('lazy tokens:  ', [text[i:j] for tag, i, j in lazy.tokens(text) if tag],
+          '%d flushes of %d states' % (lazy.flushes, lazy.max_states))
 
 
 if __name__ == '__main__':
@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+import random
+import unittest
+from subset_construction import dense_table, hopcroft_minimize, row_displacement
+
+
+def random_dfa(rng, tags):
+    """{state: {symbol: state}} over 1-3 symbols, each state rejecting or carrying one of tags"""
+    n = rng.randint(1, 12)
+    alphabet = ['a', 'b', 'c'][:rng.randint(1, 3)]
+    d_trans = {s: {c: rng.randrange(n) for c in alphabet} for s in range(n)}
+    tag = {s: rng.choice([None] + tags) for s in range(n)}
+    return d_trans, alphabet, tag.get
+
+
+def moore_blocks(d_trans, alphabet, accepting):
+    """Equivalence classes by brute-force Moore refinement, as a set of frozensets"""
+    part = {s: accepting(s) for s in d_trans}
+    while True:
+        signature = {s: (part[s],) + tuple(part[d_trans[s][c]] for c in alphabet) for s in d_trans}
+        ids = {}
+        refined = {s: ids.setdefault(signature[s], len(ids)) for s in d_trans}
+        if len(ids) == len(set(part.values())):
+            break
+        part = refined
+    blocks = {}
+    for s, i in refined.items():
+        blocks.setdefault(i, set()).add(s)
+    return {frozenset(block) for block in blocks.values()}
+
+
+class HopcroftTest(unittest.TestCase):
+    def test_matches_moore_refinement(self):
+        rng = random.Random(20)
+        for _ in range(3000):
+            d_trans, alphabet, accepting = random_dfa(rng, ['x', 'y', 'z'])
+            blocks = hopcroft_minimize(d_trans, alphabet, accepting)
+            self.assertEqual({frozenset(block) for block in blocks if block},
+                             moore_blocks(d_trans, alphabet, accepting))
+
+    def test_row_displacement_decodes(self):
+        rng = random.Random(21)
+        for _ in range(300):
+            d_trans, alphabet, accepting = random_dfa(rng, ['x'])
+            table, _ = dense_table(d_trans, alphabet, accepting, hopcroft_minimize(d_trans, alphabet, accepting))
+            base, next_, check = row_displacement(table)
+            for i, row in enumerate(table):
+                for j, t in enumerate(row):
+                    k = base[i] + j
+                    self.assertEqual(next_[k] if k < len(check) and check[k] == i else -1, t)
+
+
+if __name__ == '__main__':
+    unittest.main()
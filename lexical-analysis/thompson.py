@@ -0,0 +1,265 @@
+#!/usr/bin/env python3
+import itertools
+import networkx as nx
+from subset_construction import byte_classes, dense_table, hopcroft_minimize, subset_construction
+
+BYTES = [chr(b) for b in range(256)]
+ESCAPES = {
+    'd': frozenset('0123456789'),
+    'w': frozenset('0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz'),
+    's': frozenset(' \t\n\r\f\v'),
+    'n': frozenset('\n'), 't': frozenset('\t'), 'r': frozenset('\r'), 'f': frozenset('\f'), 'v': frozenset('\v'),
+}
+
+
+def parse_regex(pattern):
+    """
+    Parses a regular expression into a tree of tuples:
+    ('set', symbols) | ('cat', [trees]) | ('alt', [trees]) | ('repeat', tree, min, max or None)
+    Supports | * + ? {m} {m,} {m,n}, groups, '.', [classes] with ranges and ^, and the escapes
+    \\d \\w \\s (and \\D \\W \\S), \\n \\t \\r \\f \\v, \\xHH; symbols are the 256 byte values.
+    Raises ValueError, with the offset, on malformed patterns.
+    """
+    pos = 0
+
+    def error(message):
+        raise ValueError('%s at offset %d of %r' % (message, pos, pattern))
+
+    def peek():
+        return pattern[pos] if pos < len(pattern) else None
+
+    def escape():  # after the backslash
+        nonlocal pos
+        if pos >= len(pattern):
+            error('trailing backslash')
+        c = pattern[pos]
+        pos += 1
+        if c.lower() in 'dws':
+            symbols = ESCAPES[c.lower()]
+            return symbols if c.islower() else frozenset(BYTES) - symbols
+        if c in ESCAPES:
+            return ESCAPES[c]
+        if c == 'x':
+            digits = pattern[pos:pos + 2]
+            if len(digits) != 2 or any(d not in '0123456789abcdefABCDEF' for d in digits):
+                error('bad \\x escape')
+            pos += 2
+            return frozenset(chr(int(digits, 16)))
+        return frozenset(c)
+
+    def char_class():  # after the '['
+        nonlocal pos
+        negate = peek() == '^'
+        pos += negate
+        symbols = set()
+        first = True
+        while peek() != ']' or first:
+            if peek() is None:
+                error('unterminated [')
+            c = pattern[pos]
+            pos += 1
+            low = escape() if c == '\\' else frozenset(c)
+            if peek() == '-' and pos + 1 < len(pattern) and pattern[pos + 1] != ']' and len(low) == 1:
+                pos += 1
+                c = pattern[pos]
+                pos += 1
+                high = escape() if c == '\\' else frozenset(c)
+                if len(high) != 1 or ord(min(high)) < ord(min(low)):
+                    error('bad range')
+                low = frozenset(chr(b) for b in range(ord(min(low)), ord(min(high)) + 1))
+            symbols |= low
+            first = False
+        pos += 1
+        return frozenset(BYTES) - symbols if negate else frozenset(symbols)
+
+    def number():
+        nonlocal pos
+        begin = pos
+        while peek() is not None and peek().isdigit():
+            pos += 1
+        return int(pattern[begin:pos]) if pos > begin else None
+
+    def atom():
+        nonlocal pos
+        c = peek()
+        pos += 1
+        if c == '(':
+            tree = alternation()
+            if peek() != ')':
+                error('missing )')
+            pos += 1
+            return tree
+        if c == '[':
+            return ('set', char_class())
+        if c == '.':
+            return ('set', frozenset(BYTES) - {'\n'})
+        if c == '\\':
+            return ('set', escape())
+        return ('set', frozenset(c))
+
+    def repetition():
+        nonlocal pos
+        tree = atom()
+        while peek() is not None and peek() in '*+?{':
+            c = pattern[pos]
+            pos += 1
+            if c == '{':
+                low = number()
+                high = low
+                if peek() == ',':
+                    pos += 1
+                    high = number()
+                if low is None or peek() != '}' or (high is not None and high < low):
+                    error('bad {m,n} repetition')
+                pos += 1
+            else:
+                low, high = {'*': (0, None), '+': (1, None), '?': (0, 1)}[c]
+            tree = ('repeat', tree, low, high)
+        return tree
+
+    def concatenation():
+        trees = []
+        while peek() is not None and peek() not in '|)':
+            if peek() in '*+?{':
+                error('nothing to repeat')
+            trees.append(repetition())
+        return ('cat', trees)
+
+    def alternation():
+        nonlocal pos
+        trees = [concatenation()]
+        while peek() == '|':
+            pos += 1
+            trees.append(concatenation())
+        return trees[0] if len(trees) == 1 else ('alt', trees)
+
+    tree = alternation()
+    if pos < len(pattern):
+        error('unbalanced )')
+    return tree
+
+
+def thompson(tree, nfa, new_state):
+    """
+    Adds the Thompson NFA of a parse_regex() tree to nfa, numbering states with new_state(), and
+    returns its (start, accept); every fragment gets fresh states, so no two edges collide
+    """
+    kind = tree[0]
+    start, accept = new_state(), new_state()
+    if kind == 'set':
+        symbols = tree[1]
+        nfa.add_edge(start, accept, e=next(iter(symbols)) if len(symbols) == 1 else symbols)
+    elif kind == 'cat':
+        last = start
+        for child in tree[1]:
+            s, f = thompson(child, nfa, new_state)
+            nfa.add_edge(last, s, e='')
+            last = f
+        nfa.add_edge(last, accept, e='')
+    elif kind == 'alt':
+        for child in tree[1]:
+            s, f = thompson(child, nfa, new_state)
+            nfa.add_edge(start, s, e='')
+            nfa.add_edge(f, accept, e='')
+    else:
+        _, child, low, high = tree
+        last = start
+        for _ in range(low):
+            s, f = thompson(child, nfa, new_state)
+            nfa.add_edge(last, s, e='')
+            last = f
+        if high is None:  # a loop: last -> child -> last
+            s, f = thompson(child, nfa, new_state)
+            nfa.add_edge(last, s, e='')
+            nfa.add_edge(f, last, e='')
+        else:
+            for _ in range(high - low):  # each optional copy may end the match
+                nfa.add_edge(last, accept, e='')
+                s, f = thompson(child, nfa, new_state)
+                nfa.add_edge(last, s, e='')
+                last = f
+        nfa.add_edge(last, accept, e='')
+    return start, accept
+
+
+def rules_nfa(rules):
+    """
+    Builds one NFA for token rules, a list of (name, pattern) or (name, pattern, priority)
+    Each rule's Thompson NFA hangs off a common start state (0). Returns (nfa, start, tags), tags
+    mapping every accept state to (priority, rule id, name); rule ids are positions in rules, and
+    the default priority ranks earlier rules higher, as lex does.
+    """
+    nfa = nx.DiGraph()
+    nfa.add_node(0)
+    new_state = itertools.count(1).__next__
+    tags = {}
+    names = set()
+    for rule_id, rule in enumerate(rules):
+        name, pattern = rule[0], rule[1]
+        priority = rule[2] if len(rule) > 2 else len(rules) - rule_id
+        if name in names:
+            raise ValueError('rule %r appears twice' % name)
+        names.add(name)
+        s, f = thompson(parse_regex(pattern), nfa, new_state)
+        nfa.add_edge(0, s, e='')
+        tags[f] = (priority, rule_id, name)
+    return nfa, 0, tags
+
+
+def rule_accepting(tags):
+    """
+    accepting(state) for DFA states of a rules_nfa(): the name of the highest-priority rule with
+    an accept state in the subset (the lowest rule id on ties), or None. Keeps nothing between
+    calls; callers cache per state (LazyDFA.tags is flushed with the rest of its cache).
+    """
+    def accepting(state):
+        found = [tags[s] for s in state if s in tags]
+        return min(found, key=lambda t: (-t[0], t[1]))[2] if found else None
+    return accepting
+
+
+def compile_rules(rules):
+    """
+    Returns (table, accept, classes, names) for a scanner of all rules: the minimized
+    dense_table() over byte_classes(), and the rule names in rule id order
+    """
+    nfa, start, tags = rules_nfa(rules)
+    accepting = rule_accepting(tags)
+    classes = byte_classes(nfa, BYTES)
+    alphabet = [members[0] for members in classes]
+    dfa = subset_construction(nfa, start, alphabet)
+    table, accept = dense_table(dfa, alphabet, accepting, hopcroft_minimize(dfa, alphabet, accepting))
+    return table, accept, classes, [rule[0] for rule in rules]
+
+
+TOKEN_RULES = [
+    ('keyword', r'if|else|while|return'),
+    ('identifier', r'[A-Za-z_]\w*'),
+    ('number', r'\d+(\.\d+)?([eE][-+]?\d+)?'),
+    ('string', r'"([^"\\\n]|\\.)*"'),
+    ('operator', r'[-+*/%=<>!]=?|&&|\|\||[(){};,]'),
+    ('space', r'[ \t\r\n]+'),
+]
+
+
+def main():
+    table, accept, classes, names = compile_rules(TOKEN_RULES)
+    print('%d rules: %d byte classes, %d states' % (len(names), len(classes), len(table)))
+    class_of = {c: j for j, members in enumerate(classes) for c in members}
+    text = 'if (iffy >= 3.5e2) return "a\\"b";'
+    pos = 0
+    while pos < len(text):
+        state, tag, end = 0, None, pos + 1
+        for i in range(pos, len(text)):
+            state = table[state][class_of[text[i]]]
+            if state < 0:
+                break
+            if accept[state] is not None:
+                tag, end = accept[state], i + 1
+        if tag != 'space':
+            print('%-10s %s' % (tag, text[pos:end]))
+        pos = end
+
+
+if __name__ == '__main__':
+    main()